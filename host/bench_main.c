@@ -0,0 +1,47 @@
+/**
+ * Run the pipeline micro benchmarks on the host
+ *   bench [prefix] [iterations]
+ *   bench step
+ */
+#include "mgos.h"
+
+#include "bench.h"
+
+static void print_result(const bench_result_t *result, void *user_data)
+{
+  uint32_t cycles_per_us = *(uint32_t *)user_data;
+  double mean = result->iterations > 0 ? (double)result->total / result->iterations : 0;
+  printf("%-28s %10u %10u %12.1f %10u %10.3f\n", result->name, (unsigned)result->iterations,
+         (unsigned)result->min, mean, (unsigned)result->max, cycles_per_us > 0 ? mean / cycles_per_us : 0);
+}
+
+static void print_step_result(const bench_step_result_t *result, void *user_data UNUSED_ARG)
+{
+  printf("%-28s %8u %10u %10u %10u %8.2f %8.2f %8.3f\n", result->name, (unsigned)result->rate_hz,
+         (unsigned)result->output_period_ms, (unsigned)result->latency_ms, (unsigned)result->ramp_lag_ms,
+         result->step, result->input_noise, result->output_noise);
+}
+
+int main(int argc, char **argv)
+{
+  const char *prefix = argc > 1 ? argv[1] : NULL;
+  if (prefix != NULL && strcmp(prefix, "step") == 0)
+  {
+    printf("%-28s %8s %10s %10s %10s %8s %8s %8s\n", "chain", "rate hz", "period ms", "latency ms", "ramp lag", "step", "noise in", "noise out");
+    bench_step_run(print_step_result, NULL);
+    return 0;
+  }
+
+  uint32_t iterations = argc > 2 ? strtoul(argv[2], NULL, 10) : 10000;
+  uint32_t cycles_per_us = bench_cycles_per_us();
+
+  bench_init();
+  printf("cycles per us %u, overhead subtracted per call\n", (unsigned)cycles_per_us);
+  printf("%-28s %10s %10s %12s %10s %10s\n", "case", "iterations", "min", "mean", "max", "mean us");
+  if (bench_run(prefix, iterations, print_result, &cycles_per_us) == 0)
+  {
+    fprintf(stderr, "no benchmark matches '%s'\n", prefix);
+    return 1;
+  }
+  return 0;
+}
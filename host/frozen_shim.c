@@ -0,0 +1,217 @@
+/**
+ * Subset of frozen json_printf for the host build
+ * Same rules as on the device: identifiers in the format are quoted,
+ * %B prints true/false, %Q prints a quoted string, anything else goes to snprintf
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/mbuf.h"
+#include "frozen.h"
+
+int json_printer_buf(struct json_out *out, const char *buf, size_t len)
+{
+  size_t avail = out->u.buf.size - out->u.buf.len;
+  size_t n = len < avail ? len : avail;
+  memcpy(out->u.buf.buf + out->u.buf.len, buf, n);
+  out->u.buf.len += n;
+  if (out->u.buf.size > 0)
+  {
+    size_t idx = out->u.buf.len;
+    if (idx >= out->u.buf.size)
+      idx = out->u.buf.size - 1;
+    out->u.buf.buf[idx] = '\0';
+  }
+  return len;
+}
+
+int json_printer_mbuf(struct json_out *out, const char *buf, size_t len)
+{
+  mbuf_append((struct mbuf *)out->u.data, buf, len);
+  return len;
+}
+
+static bool is_identifier(char c, bool first)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || (!first && c >= '0' && c <= '9');
+}
+
+static int json_print_quoted(struct json_out *out, const char *str)
+{
+  int len = 0;
+  if (str == NULL)
+    return out->printer(out, "null", 4);
+  len += out->printer(out, "\"", 1);
+  for (; *str != '\0'; str++)
+  {
+    const char *esc = strchr("\"\\", *str) != NULL ? "\\" : NULL;
+    if (esc != NULL)
+      len += out->printer(out, esc, 1);
+    len += out->printer(out, str, 1);
+  }
+  len += out->printer(out, "\"", 1);
+  return len;
+}
+
+#define JSON_SHIM_PRINT(type)                                                      \
+  do                                                                               \
+  {                                                                                \
+    type value = va_arg(ap, type);                                                 \
+    int need = nstars == 0   ? snprintf(NULL, 0, spec, value)                      \
+               : nstars == 1 ? snprintf(NULL, 0, spec, stars[0], value)            \
+                             : snprintf(NULL, 0, spec, stars[0], stars[1], value); \
+    char *tmp = malloc(need + 1);                                                  \
+    if (tmp == NULL)                                                               \
+      break;                                                                       \
+    if (nstars == 0)                                                               \
+      snprintf(tmp, need + 1, spec, value);                                        \
+    else if (nstars == 1)                                                          \
+      snprintf(tmp, need + 1, spec, stars[0], value);                              \
+    else                                                                           \
+      snprintf(tmp, need + 1, spec, stars[0], stars[1], value);                    \
+    len += out->printer(out, tmp, need);                                           \
+    free(tmp);                                                                     \
+  } while (0)
+
+int json_vprintf(struct json_out *out, const char *fmt, va_list xap)
+{
+  int len = 0;
+  va_list ap;
+  va_copy(ap, xap);
+
+  while (*fmt != '\0')
+  {
+    if (strchr(":, \r\n\t[]{}\"", *fmt) != NULL)
+    {
+      len += out->printer(out, fmt, 1);
+      fmt++;
+    }
+    else if (*fmt == '%')
+    {
+      char spec[32];
+      size_t n = 0;
+      int stars[2];
+      int nstars = 0;
+      int longs = 0;
+      bool size = false;
+
+      spec[n++] = *fmt++;
+      if (*fmt == 'B')
+      {
+        const char *b = va_arg(ap, int) ? "true" : "false";
+        len += out->printer(out, b, strlen(b));
+        fmt++;
+        continue;
+      }
+      if (*fmt == 'Q')
+      {
+        len += json_print_quoted(out, va_arg(ap, const char *));
+        fmt++;
+        continue;
+      }
+      if (*fmt == '%')
+      {
+        len += out->printer(out, fmt, 1);
+        fmt++;
+        continue;
+      }
+      while (*fmt != '\0' && strchr("-+ #0123456789.*", *fmt) != NULL && n < sizeof(spec) - 4)
+      {
+        if (*fmt == '*' && nstars < 2)
+          stars[nstars++] = va_arg(ap, int);
+        spec[n++] = *fmt++;
+      }
+      while (*fmt != '\0' && strchr("hlzjt", *fmt) != NULL && n < sizeof(spec) - 2)
+      {
+        if (*fmt == 'l')
+          longs++;
+        if (*fmt == 'z')
+          size = true;
+        spec[n++] = *fmt++;
+      }
+      if (*fmt == '\0')
+        break;
+      char conversion = *fmt++;
+      spec[n++] = conversion;
+      spec[n] = '\0';
+
+      switch (conversion)
+      {
+      case 'd':
+      case 'i':
+        if (size)
+          JSON_SHIM_PRINT(size_t);
+        else if (longs >= 2)
+          JSON_SHIM_PRINT(long long);
+        else if (longs == 1)
+          JSON_SHIM_PRINT(long);
+        else
+          JSON_SHIM_PRINT(int);
+        break;
+      case 'u':
+      case 'x':
+      case 'X':
+      case 'o':
+        if (size)
+          JSON_SHIM_PRINT(size_t);
+        else if (longs >= 2)
+          JSON_SHIM_PRINT(unsigned long long);
+        else if (longs == 1)
+          JSON_SHIM_PRINT(unsigned long);
+        else
+          JSON_SHIM_PRINT(unsigned int);
+        break;
+      case 'c':
+        JSON_SHIM_PRINT(int);
+        break;
+      case 'f':
+      case 'F':
+      case 'e':
+      case 'E':
+      case 'g':
+      case 'G':
+        JSON_SHIM_PRINT(double);
+        break;
+      case 's':
+        JSON_SHIM_PRINT(const char *);
+        break;
+      case 'p':
+        JSON_SHIM_PRINT(void *);
+        break;
+      default:
+        break;
+      }
+    }
+    else if (is_identifier(*fmt, true))
+    {
+      len += out->printer(out, "\"", 1);
+      while (is_identifier(*fmt, false))
+      {
+        len += out->printer(out, fmt, 1);
+        fmt++;
+      }
+      len += out->printer(out, "\"", 1);
+    }
+    else
+    {
+      len += out->printer(out, fmt, 1);
+      fmt++;
+    }
+  }
+  va_end(ap);
+
+  return len;
+}
+
+int json_printf(struct json_out *out, const char *fmt, ...)
+{
+  int len;
+  va_list ap;
+  va_start(ap, fmt);
+  len = json_vprintf(out, fmt, ap);
+  va_end(ap);
+  return len;
+}
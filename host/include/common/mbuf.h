@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stddef.h>
+
+struct mbuf
+{
+  char *buf;
+  size_t len;
+  size_t size;
+};
+
+void mbuf_init(struct mbuf *mbuf, size_t initial_capacity);
+void mbuf_free(struct mbuf *mbuf);
+size_t mbuf_append(struct mbuf *mbuf, const void *data, size_t data_size);
+void mbuf_clear(struct mbuf *mbuf);
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+
+// linear model of an ESP32 ADC1 at 11dB, enough to run the pipeline in
+// millivolts on the host
+typedef enum
+{
+  ADC_UNIT_1 = 1,
+} adc_unit_t;
+
+typedef enum
+{
+  ADC_ATTEN_DB_11 = 3,
+} adc_atten_t;
+
+typedef enum
+{
+  ADC_WIDTH_BIT_12 = 3,
+} adc_bits_width_t;
+
+typedef enum
+{
+  ESP_ADC_CAL_VAL_EFUSE_VREF = 0,
+  ESP_ADC_CAL_VAL_EFUSE_TP = 1,
+  ESP_ADC_CAL_VAL_DEFAULT_VREF = 2,
+} esp_adc_cal_value_t;
+
+typedef struct
+{
+  uint32_t coeff_a;
+  uint32_t coeff_b;
+} esp_adc_cal_characteristics_t;
+
+static inline esp_adc_cal_value_t esp_adc_cal_characterize(adc_unit_t adc_num, adc_atten_t atten, adc_bits_width_t bit_width,
+                                                           uint32_t default_vref, esp_adc_cal_characteristics_t *chars)
+{
+  (void)adc_num;
+  (void)atten;
+  (void)bit_width;
+  // 150 mV at code 0, 3.1 V full scale
+  chars->coeff_a = default_vref * 2950 / 1100;
+  chars->coeff_b = 150;
+  return ESP_ADC_CAL_VAL_DEFAULT_VREF;
+}
+
+static inline uint32_t esp_adc_cal_raw_to_voltage(uint32_t adc_reading, const esp_adc_cal_characteristics_t *chars)
+{
+  return (adc_reading * chars->coeff_a + 2047) / 4095 + chars->coeff_b;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stddef.h>
+
+// subset of frozen json_printf, unquoted keys are quoted and %B prints booleans
+struct json_out
+{
+  int (*printer)(struct json_out *, const char *str, size_t len);
+  union {
+    struct
+    {
+      char *buf;
+      size_t size;
+      size_t len;
+    } buf;
+    void *data;
+  } u;
+};
+
+int json_printer_buf(struct json_out *, const char *, size_t);
+int json_printer_mbuf(struct json_out *, const char *, size_t);
+
+#define JSON_OUT_BUF(buf, len) \
+  {                            \
+    json_printer_buf,          \
+    {                          \
+      {                        \
+        buf, len, 0            \
+      }                        \
+    }                          \
+  }
+#define JSON_OUT_MBUF(mb)  \
+  {                        \
+    json_printer_mbuf,     \
+    {                      \
+      {                    \
+        (char *)mb, 0, 0   \
+      }                    \
+    }                      \
+  }
+
+int json_printf(struct json_out *, const char *fmt, ...);
+int json_vprintf(struct json_out *, const char *fmt, va_list ap);
@@ -0,0 +1,52 @@
+/**
+ * Host shim of the Mongoose OS API
+ * Only what the portable sensing pipeline in src/ needs is provided,
+ * see mgos_shim.h for the controls used by the replay driver
+ */
+#pragma once
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common/mbuf.h"
+#include "frozen.h"
+#include "mgos_event.h"
+#include "mgos_system.h"
+#include "mgos_timers.h"
+#include "mgos_sys_config.h"
+
+#ifndef UNUSED_ARG
+#define UNUSED_ARG __attribute__((unused))
+#endif
+
+enum cs_log_level
+{
+  LL_NONE = -1,
+  LL_ERROR = 0,
+  LL_WARN = 1,
+  LL_INFO = 2,
+  LL_DEBUG = 3,
+  LL_VERBOSE_DEBUG = 4
+};
+
+extern enum cs_log_level mgos_shim_log_level;
+void mgos_shim_log_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#define LOG(l, x)                      \
+  do                                   \
+  {                                    \
+    if ((l) <= mgos_shim_log_level)    \
+    {                                  \
+      mgos_shim_log_printf x;          \
+    }                                  \
+  } while (0)
+
+// wall clock follows the replayed trace, not the host
+time_t mgos_shim_time(time_t *t);
+#define time(t) mgos_shim_time(t)
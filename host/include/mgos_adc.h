@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdbool.h>
+
+bool mgos_adc_enable(int pin);
+int mgos_adc_read(int pin);
@@ -0,0 +1,8 @@
+#pragma once
+
+struct mgos_bme280_data
+{
+  double temp;
+  double press;
+  double humid;
+};
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdbool.h>
+
+#define MGOS_EVENT_BASE(a, b, c) ((a) << 24 | (b) << 16 | (c) << 8)
+#define MGOS_EVENT_GRP_MASK 0xffffff00
+
+typedef void (*mgos_event_handler_t)(int ev, void *ev_data, void *userdata);
+
+bool mgos_event_register_base(int base_event_number, const char *name);
+bool mgos_event_add_handler(int ev, mgos_event_handler_t cb, void *userdata);
+bool mgos_event_add_group_handler(int evgrp, mgos_event_handler_t cb, void *userdata);
+int mgos_event_trigger(int ev, void *ev_data);
@@ -0,0 +1,3 @@
+#pragma once
+
+// RPC is not available on the host, handlers are registered by main.c only
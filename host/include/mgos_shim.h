@@ -0,0 +1,13 @@
+/**
+ * Controls of the host shim used by the replay driver
+ */
+#pragma once
+
+#include <stdint.h>
+
+// virtual clock in milliseconds, timers due up to this point fire in order
+uint64_t mgos_shim_now_ms(void);
+void mgos_shim_advance_to(uint64_t now_ms);
+
+// value returned by mgos_adc_read() until the next update
+void mgos_shim_adc_set(int pin, int value);
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+
+// mirrors the config_schema entries from mos.yml used by the pipeline
+#define MGOS_CONFIG_HAVE_BOARD_PRESSURE_PIN
+#define MGOS_CONFIG_HAVE_TANK
+
+struct mgos_config
+{
+  int board_pressure_pin;
+  int tank_adc_pressure_low_threshold;
+  int tank_adc_pressure_high_threshold;
+  int tank_mv_pressure_low_threshold;
+  int tank_mv_pressure_high_threshold;
+  float tank_liters_low_threshold;
+  float tank_liters_high_threshold;
+  int tank_frequency_high_threshold;
+  const char *tank_geometry_shape;
+  float tank_geometry_diameter_cm;
+  float tank_geometry_length_cm;
+  float tank_geometry_width_cm;
+  float tank_geometry_height_cm;
+  const char *tank_geometry_strapping_file;
+  const char *tank_calibration_file;
+  bool tank_calibration_monotone;
+  bool tank_autocal_enable;
+  const char *tank_autocal_file;
+  bool tank_drift_enable;
+  bool tank_drift_air_pressure;
+  float tank_totalizer_k_factor;
+  const char *tank_totalizer_file;
+};
+
+extern struct mgos_config mgos_sys_config;
+
+#define MGOS_SHIM_CONFIG_ACCESSORS(type, name)                  \
+  static inline type mgos_sys_config_get_##name(void)           \
+  {                                                             \
+    return mgos_sys_config.name;                                \
+  }                                                             \
+  static inline void mgos_sys_config_set_##name(type value)     \
+  {                                                             \
+    mgos_sys_config.name = value;                               \
+  }
+
+MGOS_SHIM_CONFIG_ACCESSORS(int, board_pressure_pin)
+MGOS_SHIM_CONFIG_ACCESSORS(int, tank_adc_pressure_low_threshold)
+MGOS_SHIM_CONFIG_ACCESSORS(int, tank_adc_pressure_high_threshold)
+MGOS_SHIM_CONFIG_ACCESSORS(int, tank_mv_pressure_low_threshold)
+MGOS_SHIM_CONFIG_ACCESSORS(int, tank_mv_pressure_high_threshold)
+MGOS_SHIM_CONFIG_ACCESSORS(float, tank_liters_low_threshold)
+MGOS_SHIM_CONFIG_ACCESSORS(float, tank_liters_high_threshold)
+MGOS_SHIM_CONFIG_ACCESSORS(int, tank_frequency_high_threshold)
+MGOS_SHIM_CONFIG_ACCESSORS(const char *, tank_geometry_shape)
+MGOS_SHIM_CONFIG_ACCESSORS(float, tank_geometry_diameter_cm)
+MGOS_SHIM_CONFIG_ACCESSORS(float, tank_geometry_length_cm)
+MGOS_SHIM_CONFIG_ACCESSORS(float, tank_geometry_width_cm)
+MGOS_SHIM_CONFIG_ACCESSORS(float, tank_geometry_height_cm)
+MGOS_SHIM_CONFIG_ACCESSORS(const char *, tank_geometry_strapping_file)
+MGOS_SHIM_CONFIG_ACCESSORS(const char *, tank_calibration_file)
+MGOS_SHIM_CONFIG_ACCESSORS(bool, tank_calibration_monotone)
+MGOS_SHIM_CONFIG_ACCESSORS(bool, tank_autocal_enable)
+MGOS_SHIM_CONFIG_ACCESSORS(const char *, tank_autocal_file)
+MGOS_SHIM_CONFIG_ACCESSORS(bool, tank_drift_enable)
+MGOS_SHIM_CONFIG_ACCESSORS(bool, tank_drift_air_pressure)
+MGOS_SHIM_CONFIG_ACCESSORS(float, tank_totalizer_k_factor)
+MGOS_SHIM_CONFIG_ACCESSORS(const char *, tank_totalizer_file)
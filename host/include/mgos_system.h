@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef void (*mgos_cb_t)(void *arg);
+
+double mgos_uptime(void);
+// cycle counter frequency, calibrated on first call
+int mgos_get_cpu_freq(void);
+size_t mgos_get_heap_size(void);
+size_t mgos_get_free_heap_size(void);
+size_t mgos_get_min_free_heap_size(void);
+// the host has a single loop, callbacks run right away
+bool mgos_invoke_cb(mgos_cb_t cb, void *arg, bool from_isr);
@@ -0,0 +1,300 @@
+/**
+ * Host implementation of the Mongoose OS shim
+ * Single threaded, driven by a virtual clock advanced from the replay driver
+ */
+#include <stdarg.h>
+
+#include "mgos.h"
+#include "mgos_adc.h"
+#include "mgos_shim.h"
+
+#include "bench.h"
+
+#define SHIM_MAX_EVENT_HANDLERS 32
+#define SHIM_MAX_TIMERS 16
+#define SHIM_MAX_ADC_PINS 40
+
+enum cs_log_level mgos_shim_log_level = LL_WARN;
+
+// defaults as in mos.yml
+struct mgos_config mgos_sys_config = {
+    .board_pressure_pin = 35,
+    .tank_adc_pressure_low_threshold = 358,
+    .tank_adc_pressure_high_threshold = 605,
+    .tank_mv_pressure_low_threshold = 410,
+    .tank_mv_pressure_high_threshold = 590,
+    .tank_liters_low_threshold = 80,
+    .tank_liters_high_threshold = 180,
+    .tank_frequency_high_threshold = 15,
+    .tank_geometry_shape = "horizontal_cylinder",
+    .tank_geometry_diameter_cm = 50,
+    .tank_geometry_length_cm = 100,
+    .tank_geometry_width_cm = 0,
+    .tank_geometry_height_cm = 0,
+    .tank_geometry_strapping_file = "strapping.csv",
+    .tank_calibration_file = "calibration.csv",
+    .tank_calibration_monotone = true,
+    .tank_autocal_enable = false,
+    .tank_autocal_file = "autocal.csv",
+    .tank_drift_enable = false,
+    .tank_drift_air_pressure = false,
+    .tank_totalizer_k_factor = 450,
+    .tank_totalizer_file = "totalizer.csv",
+};
+
+static uint64_t now_ms = 0;
+
+void mgos_shim_log_printf(const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  fprintf(stderr, "%8.3f ", now_ms / 1000.0);
+  vfprintf(stderr, fmt, ap);
+  fputc('\n', stderr);
+  va_end(ap);
+}
+
+time_t mgos_shim_time(time_t *t)
+{
+  time_t result = (time_t)(now_ms / 1000);
+  if (t != NULL)
+    *t = result;
+  return result;
+}
+
+double mgos_uptime(void)
+{
+  return now_ms / 1000.0;
+}
+
+int mgos_get_cpu_freq(void)
+{
+  static int cpu_freq_hz = 0;
+  if (cpu_freq_hz > 0)
+    return cpu_freq_hz;
+
+  struct timespec start, now;
+  bench_cycles_t start_cycles = bench_cycles();
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  do
+  {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+  } while ((now.tv_sec - start.tv_sec) * 1000000000L + (now.tv_nsec - start.tv_nsec) < 50000000L);
+  bench_cycles_t elapsed_cycles = bench_cycles() - start_cycles;
+  cpu_freq_hz = (int)(elapsed_cycles * 20ULL);
+  return cpu_freq_hz;
+}
+
+// the host heap is not tracked
+size_t mgos_get_heap_size(void)
+{
+  return 0;
+}
+
+size_t mgos_get_free_heap_size(void)
+{
+  return 0;
+}
+
+size_t mgos_get_min_free_heap_size(void)
+{
+  return 0;
+}
+
+bool mgos_invoke_cb(mgos_cb_t cb, void *arg, bool from_isr UNUSED_ARG)
+{
+  cb(arg);
+  return true;
+}
+
+// events
+struct shim_event_handler
+{
+  int ev;
+  int mask;
+  mgos_event_handler_t cb;
+  void *userdata;
+};
+
+static struct shim_event_handler event_handlers[SHIM_MAX_EVENT_HANDLERS];
+static size_t event_handlers_count = 0;
+
+bool mgos_event_register_base(int base_event_number UNUSED_ARG, const char *name UNUSED_ARG)
+{
+  return true;
+}
+
+static bool shim_event_add(int ev, int mask, mgos_event_handler_t cb, void *userdata)
+{
+  if (event_handlers_count == SHIM_MAX_EVENT_HANDLERS)
+    return false;
+  event_handlers[event_handlers_count++] = (struct shim_event_handler){
+      .ev = ev,
+      .mask = mask,
+      .cb = cb,
+      .userdata = userdata,
+  };
+  return true;
+}
+
+bool mgos_event_add_handler(int ev, mgos_event_handler_t cb, void *userdata)
+{
+  return shim_event_add(ev, ~0, cb, userdata);
+}
+
+bool mgos_event_add_group_handler(int evgrp, mgos_event_handler_t cb, void *userdata)
+{
+  return shim_event_add(evgrp & MGOS_EVENT_GRP_MASK, MGOS_EVENT_GRP_MASK, cb, userdata);
+}
+
+int mgos_event_trigger(int ev, void *ev_data)
+{
+  int handled = 0;
+  for (size_t i = 0; i < event_handlers_count; i++)
+  {
+    if ((ev & event_handlers[i].mask) != event_handlers[i].ev)
+      continue;
+    event_handlers[i].cb(ev, ev_data, event_handlers[i].userdata);
+    handled++;
+  }
+  return handled;
+}
+
+// timers
+struct shim_timer
+{
+  mgos_timer_id id;
+  uint64_t due_ms;
+  int period_ms;
+  int flags;
+  timer_callback cb;
+  void *cb_arg;
+};
+
+static struct shim_timer timers[SHIM_MAX_TIMERS];
+static mgos_timer_id last_timer_id = MGOS_INVALID_TIMER_ID;
+
+mgos_timer_id mgos_set_timer(int msecs, int flags, timer_callback cb, void *cb_arg)
+{
+  for (size_t i = 0; i < SHIM_MAX_TIMERS; i++)
+  {
+    if (timers[i].id != MGOS_INVALID_TIMER_ID)
+      continue;
+    timers[i] = (struct shim_timer){
+        .id = ++last_timer_id,
+        .due_ms = now_ms + msecs,
+        .period_ms = msecs,
+        .flags = flags,
+        .cb = cb,
+        .cb_arg = cb_arg,
+    };
+    return timers[i].id;
+  }
+  return MGOS_INVALID_TIMER_ID;
+}
+
+void mgos_clear_timer(mgos_timer_id id)
+{
+  if (id == MGOS_INVALID_TIMER_ID)
+    return;
+  for (size_t i = 0; i < SHIM_MAX_TIMERS; i++)
+  {
+    if (timers[i].id == id)
+      timers[i].id = MGOS_INVALID_TIMER_ID;
+  }
+}
+
+static struct shim_timer *shim_next_timer(uint64_t until_ms)
+{
+  struct shim_timer *next = NULL;
+  for (size_t i = 0; i < SHIM_MAX_TIMERS; i++)
+  {
+    if (timers[i].id == MGOS_INVALID_TIMER_ID || timers[i].due_ms > until_ms)
+      continue;
+    if (next == NULL || timers[i].due_ms < next->due_ms)
+      next = &timers[i];
+  }
+  return next;
+}
+
+uint64_t mgos_shim_now_ms(void)
+{
+  return now_ms;
+}
+
+void mgos_shim_advance_to(uint64_t target_ms)
+{
+  struct shim_timer *timer;
+  while ((timer = shim_next_timer(target_ms)) != NULL)
+  {
+    now_ms = timer->due_ms;
+    // copy as the callback can clear or re-arm timers
+    struct shim_timer fired = *timer;
+    if (fired.flags & MGOS_TIMER_REPEAT)
+      timer->due_ms += (fired.period_ms > 0 ? fired.period_ms : 1);
+    else
+      timer->id = MGOS_INVALID_TIMER_ID;
+    fired.cb(fired.cb_arg);
+  }
+  if (target_ms > now_ms)
+    now_ms = target_ms;
+}
+
+// adc
+static int adc_values[SHIM_MAX_ADC_PINS];
+
+bool mgos_adc_enable(int pin)
+{
+  return pin >= 0 && pin < SHIM_MAX_ADC_PINS;
+}
+
+int mgos_adc_read(int pin)
+{
+  if (pin < 0 || pin >= SHIM_MAX_ADC_PINS)
+    return 0;
+  return adc_values[pin];
+}
+
+void mgos_shim_adc_set(int pin, int value)
+{
+  if (pin < 0 || pin >= SHIM_MAX_ADC_PINS)
+    return;
+  adc_values[pin] = value;
+}
+
+// mbuf
+void mbuf_init(struct mbuf *mbuf, size_t initial_capacity)
+{
+  mbuf->len = 0;
+  mbuf->size = 0;
+  mbuf->buf = NULL;
+  if (initial_capacity > 0 && (mbuf->buf = malloc(initial_capacity)) != NULL)
+    mbuf->size = initial_capacity;
+}
+
+void mbuf_free(struct mbuf *mbuf)
+{
+  free(mbuf->buf);
+  mbuf_init(mbuf, 0);
+}
+
+size_t mbuf_append(struct mbuf *mbuf, const void *data, size_t data_size)
+{
+  if (mbuf->len + data_size > mbuf->size)
+  {
+    size_t new_size = (mbuf->len + data_size) * 3 / 2;
+    char *p = realloc(mbuf->buf, new_size);
+    if (p == NULL)
+      return 0;
+    mbuf->buf = p;
+    mbuf->size = new_size;
+  }
+  memcpy(mbuf->buf + mbuf->len, data, data_size);
+  mbuf->len += data_size;
+  return data_size;
+}
+
+void mbuf_clear(struct mbuf *mbuf)
+{
+  mbuf->len = 0;
+}
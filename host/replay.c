@@ -0,0 +1,315 @@
+/**
+ * Replay recorded sensor traces through the firmware pipeline on the host
+ *
+ * Trace is a text file with one sample per line, time in milliseconds:
+ *   <t_ms>,adc,<raw_adc>
+ *   <t_ms>,bme,<temperature>,<pressure>,<humidity>
+ *   <t_ms>,cnt,<count>,<frequency>
+ * Lines starting with # are ignored. ADC values are sampled and held, the
+ * pressure sensor timer reads them at its own rate as it does on the device.
+ *
+ * Every notification is written to stdout as
+ *   <t_ms> status|raw <json>
+ */
+#include <getopt.h>
+
+#include "mgos.h"
+#include "mgos_bme280.h"
+#include "mgos_shim.h"
+
+#include "sensor_bme280.h"
+#include "sensor_pressure.h"
+#include "sensor_counter.h"
+#include "tank_volume.h"
+#include "tank_autocal.h"
+#include "tank_drift.h"
+#include "tank_totalizer.h"
+#include "tank_report.h"
+#if PIPELINE_STATS_MODE==1
+#include "sensor.h"
+#endif
+
+#define TAG "Replay"
+
+static float liters_low_value = -1;
+static float liters_high_value = -1;
+static int freq_thr_hz = -1;
+
+static bool print_raw = true;
+
+// through the version cache like the firmware consumers
+static void print_report(const char *kind, const struct mbuf *(*payload)(void))
+{
+  const struct mbuf *buffer = payload();
+  printf("%llu %s %.*s\n", (unsigned long long)mgos_shim_now_ms(), kind, (int)buffer->len, buffer->buf);
+}
+
+static void pressure_cb(int ev, void *evd, void *user_data UNUSED_ARG)
+{
+  if (ev != PRESSURE_MEASUREMENT)
+    return;
+  tank_report_set_pressure((pressure_status_t *)evd);
+  if (print_raw)
+    print_report("raw", tank_report_raw_json);
+}
+
+static void tank_volume_cb(int ev, void *evd, void *user_data UNUSED_ARG)
+{
+  if (ev != VOLUME_MEASUREMENT)
+    return;
+  tank_report_set_volume((tank_volume_t *)evd, liters_low_value, liters_high_value);
+  print_report("status", tank_report_status_json);
+}
+
+static void bme280_cb(int ev, void *evd, void *user_data UNUSED_ARG)
+{
+  if (ev != ENV_MEASUREMENT)
+    return;
+  struct mgos_bme280_data *environment_status = evd;
+  tank_report_set_environment(environment_status->temp, environment_status->press, environment_status->humid);
+}
+
+static void counter_cb(int ev, void *evd, void *user_data UNUSED_ARG)
+{
+  if (ev != COUNTER_CHANGE)
+    return;
+  gpio_counter_t *gpio_counter = evd;
+  if (!tank_report_set_counter(gpio_counter))
+    return;
+  if (print_raw)
+    print_report("raw", tank_report_raw_json);
+  if (!tank_report_set_overflow(gpio_counter, freq_thr_hz))
+    return;
+  print_report("status", tank_report_status_json);
+}
+
+static bool replay_line(const char *line, unsigned long line_no)
+{
+  unsigned long long t_ms;
+  char kind[8];
+  int consumed = 0;
+
+  if (line[0] == '#' || line[0] == '\n' || line[0] == '\0')
+    return true;
+  if (sscanf(line, "%llu,%7[a-z],%n", &t_ms, kind, &consumed) < 2 || consumed == 0)
+  {
+    LOG(LL_ERROR, ("%s, line %lu: can not parse '%s'", TAG, line_no, line));
+    return false;
+  }
+  if (t_ms < mgos_shim_now_ms())
+  {
+    LOG(LL_ERROR, ("%s, line %lu: time goes backwards", TAG, line_no));
+    return false;
+  }
+  mgos_shim_advance_to(t_ms);
+
+  const char *values = line + consumed;
+  if (strcmp(kind, "adc") == 0)
+  {
+    int raw_adc;
+    if (sscanf(values, "%d", &raw_adc) != 1)
+      goto bad_values;
+    mgos_shim_adc_set(mgos_sys_config_get_board_pressure_pin(), raw_adc);
+    return true;
+  }
+  if (strcmp(kind, "bme") == 0)
+  {
+    struct mgos_bme280_data environment_status;
+    if (sscanf(values, "%lf,%lf,%lf", &environment_status.temp, &environment_status.press, &environment_status.humid) != 3)
+      goto bad_values;
+    mgos_event_trigger(ENV_MEASUREMENT, &environment_status);
+    return true;
+  }
+  if (strcmp(kind, "cnt") == 0)
+  {
+    unsigned int count;
+    float frequency;
+    if (sscanf(values, "%u,%f", &count, &frequency) != 2)
+      goto bad_values;
+    gpio_counter_t gpio_counter = {
+        .count = count,
+        .frequency = frequency,
+        .timestamp_us = (int64_t)t_ms * 1000};
+    mgos_event_trigger(COUNTER_CHANGE, &gpio_counter);
+    return true;
+  }
+  LOG(LL_ERROR, ("%s, line %lu: unknown sample kind '%s'", TAG, line_no, kind));
+  return false;
+
+bad_values:
+  LOG(LL_ERROR, ("%s, line %lu: bad values for '%s'", TAG, line_no, kind));
+  return false;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "usage: %s [-p low:high] [-l low:high] [-f freq_thr] [-g strapping.csv] [-c calibration.csv] [-a autocal.csv] [-t totalizer.csv] [-d] [-s] [-v] trace.csv\n"
+          "  -p  pressure thresholds, tank.mv_pressure in mV with PRESSURE_MILLIVOLTS=1, tank.adc_pressure otherwise\n"
+          "  -l  liters thresholds (tank.liters)\n"
+          "  -f  overflow frequency threshold in Hz (tank.frequency.high_threshold)\n"
+          "  -g  height_cm,liters table of the tank (tank.geometry.strapping_file)\n"
+          "  -c  pressure,height_cm calibration curve (tank.calibration.file)\n"
+          "  -a  learn the pressure thresholds, state in the file (tank.autocal)\n"
+          "  -t  totalizer checkpoint file (tank.totalizer.file), none by default so runs are repeatable\n"
+          "  -d  learn the temperature compensation (tank.drift), repeat to fit the air pressure too\n"
+          "  -s  print status notifications only\n"
+          "  -v  more log output on stderr, repeat for debug\n",
+          name);
+}
+
+int main(int argc, char **argv)
+{
+  int opt;
+  // no checkpoint left over from a previous run unless asked for
+  mgos_sys_config_set_tank_totalizer_file("");
+  while ((opt = getopt(argc, argv, "p:l:f:g:c:a:t:dsv")) != -1)
+  {
+    switch (opt)
+    {
+    case 'p':
+    {
+      int low, high;
+      if (sscanf(optarg, "%d:%d", &low, &high) != 2)
+        goto usage_error;
+#if PRESSURE_MILLIVOLTS==1
+      mgos_sys_config_set_tank_mv_pressure_low_threshold(low);
+      mgos_sys_config_set_tank_mv_pressure_high_threshold(high);
+#else
+      mgos_sys_config_set_tank_adc_pressure_low_threshold(low);
+      mgos_sys_config_set_tank_adc_pressure_high_threshold(high);
+#endif
+      break;
+    }
+    case 'l':
+    {
+      float low, high;
+      if (sscanf(optarg, "%f:%f", &low, &high) != 2)
+        goto usage_error;
+      mgos_sys_config_set_tank_liters_low_threshold(low);
+      mgos_sys_config_set_tank_liters_high_threshold(high);
+      break;
+    }
+    case 'f':
+      mgos_sys_config_set_tank_frequency_high_threshold(atoi(optarg));
+      break;
+    case 'g':
+      mgos_sys_config_set_tank_geometry_shape("strapping");
+      mgos_sys_config_set_tank_geometry_strapping_file(optarg);
+      break;
+    case 'c':
+      mgos_sys_config_set_tank_calibration_file(optarg);
+      break;
+    case 'a':
+      mgos_sys_config_set_tank_autocal_enable(true);
+      mgos_sys_config_set_tank_autocal_file(optarg);
+      break;
+    case 't':
+      mgos_sys_config_set_tank_totalizer_file(optarg);
+      break;
+    case 'd':
+      if (mgos_sys_config_get_tank_drift_enable())
+        mgos_sys_config_set_tank_drift_air_pressure(true);
+      mgos_sys_config_set_tank_drift_enable(true);
+      break;
+    case 's':
+      print_raw = false;
+      break;
+    case 'v':
+      mgos_shim_log_level++;
+      break;
+    default:
+      goto usage_error;
+    }
+  }
+  if (optind != argc - 1)
+    goto usage_error;
+
+  FILE *trace = strcmp(argv[optind], "-") == 0 ? stdin : fopen(argv[optind], "r");
+  if (trace == NULL)
+  {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  liters_low_value = mgos_sys_config_get_tank_liters_low_threshold();
+  liters_high_value = mgos_sys_config_get_tank_liters_high_threshold();
+  freq_thr_hz = mgos_sys_config_get_tank_frequency_high_threshold();
+
+  // same order as mgos_app_init, bme280 and counter are fed from the trace
+  mgos_event_register_base(ENV_EVENT_BASE, "BME280 events");
+  mgos_event_register_base(COUNTER_EVENT_BASE, "Counter events");
+  if (!sensor_pressure_init())
+  {
+    LOG(LL_ERROR, ("%s, pressure sensor init failed", TAG));
+    return 1;
+  }
+#if PRESSURE_MILLIVOLTS==1
+  float pressure_low_value = mgos_sys_config_get_tank_mv_pressure_low_threshold();
+  float pressure_high_value = mgos_sys_config_get_tank_mv_pressure_high_threshold();
+#else
+  float pressure_low_value = mgos_sys_config_get_tank_adc_pressure_low_threshold();
+  float pressure_high_value = mgos_sys_config_get_tank_adc_pressure_high_threshold();
+#endif
+  tank_volume_init(pressure_low_value, pressure_high_value);
+  tank_autocal_init(pressure_low_value, pressure_high_value);
+  if (!tank_totalizer_init())
+    LOG(LL_ERROR, ("%s, totalizer not started, the overflow volume is not reported", TAG));
+
+  mgos_event_add_group_handler(ENV_EVENT_BASE, bme280_cb, NULL);
+  mgos_event_add_group_handler(PRESSURE_EVENT_BASE, pressure_cb, NULL);
+  mgos_event_add_group_handler(VOLUME_EVENT_BASE, tank_volume_cb, NULL);
+  mgos_event_add_group_handler(COUNTER_EVENT_BASE, counter_cb, NULL);
+  if (!sensor_pressure_start())
+  {
+    LOG(LL_ERROR, ("%s, pressure sensor start failed", TAG));
+    return 1;
+  }
+
+  char line[256];
+  unsigned long line_no = 0;
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), trace) != NULL)
+  {
+    line[strcspn(line, "\r\n")] = '\0';
+    ok = replay_line(line, ++line_no);
+  }
+  if (trace != stdin)
+    fclose(trace);
+
+  if (mgos_sys_config_get_tank_autocal_enable())
+  {
+    struct mbuf autocal_buffer;
+    mbuf_init(&autocal_buffer, 256);
+    struct json_out autocal_out = JSON_OUT_MBUF(&autocal_buffer);
+    tank_autocal_to_json(&autocal_out);
+    fprintf(stderr, "%.*s\n", (int)autocal_buffer.len, autocal_buffer.buf);
+    mbuf_free(&autocal_buffer);
+  }
+
+  if (mgos_sys_config_get_tank_drift_enable())
+  {
+    struct mbuf drift_buffer;
+    mbuf_init(&drift_buffer, 256);
+    struct json_out drift_out = JSON_OUT_MBUF(&drift_buffer);
+    tank_drift_to_json(&drift_out);
+    fprintf(stderr, "%.*s\n", (int)drift_buffer.len, drift_buffer.buf);
+    mbuf_free(&drift_buffer);
+  }
+
+#if PIPELINE_STATS_MODE==1
+  // stats go to stderr so the report stream stays comparable
+  struct mbuf stats_buffer;
+  mbuf_init(&stats_buffer, 1024);
+  struct json_out stats_out = JSON_OUT_MBUF(&stats_buffer);
+  sensor_stats_to_json(&stats_out);
+  fprintf(stderr, "%.*s\n", (int)stats_buffer.len, stats_buffer.buf);
+  mbuf_free(&stats_buffer);
+#endif
+
+  return ok ? 0 : 1;
+
+usage_error:
+  usage(argv[0]);
+  return 2;
+}
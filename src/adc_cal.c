@@ -0,0 +1,70 @@
+/**
+ * Reference:
+ * https://docs.espressif.com/projects/esp-idf/en/v4.3.5/esp32/api-reference/peripherals/adc.html#adc-calibration
+ *
+ * esp_adc_cal corrects the per chip gain and offset of ADC1 from the
+ * Two Point or Vref values burned in eFuse. Its conversion is a few
+ * multiplications and divisions, here it is done once for every raw code
+ * so a sample costs a single load.
+ */
+#include "mgos.h"
+#include "esp_adc_cal.h"
+
+#include "adc_cal.h"
+
+#define TAG "ADC calibration"
+
+// mgos_adc_enable configures ADC1 at 11dB attenuation and 12 bits
+static const adc_atten_t adc_cal_atten = ADC_ATTEN_DB_11;
+static const adc_bits_width_t adc_cal_width = ADC_WIDTH_BIT_12;
+// used only when eFuse has no calibration values
+static const uint32_t adc_cal_default_vref_mv = 1100;
+
+uint16_t adc_cal_lut[ADC_CAL_LUT_SIZE];
+
+bool adc_cal_init(void)
+{
+  static bool initialized = false;
+  if (initialized)
+    return true;
+
+  esp_adc_cal_characteristics_t characteristics;
+  esp_adc_cal_value_t source = esp_adc_cal_characterize(ADC_UNIT_1, adc_cal_atten, adc_cal_width,
+                                                        adc_cal_default_vref_mv, &characteristics);
+  LOG(LL_INFO, ("%s, characterized from %s", TAG,
+                source == ESP_ADC_CAL_VAL_EFUSE_TP     ? "eFuse two point"
+                : source == ESP_ADC_CAL_VAL_EFUSE_VREF ? "eFuse Vref"
+                                                       : "default Vref"));
+
+  for (uint32_t raw = 0; raw < ADC_CAL_LUT_SIZE; raw++)
+    adc_cal_lut[raw] = esp_adc_cal_raw_to_voltage(raw, &characteristics);
+
+  initialized = true;
+  return true;
+}
+
+int adc_cal_mv_to_raw(int mv)
+{
+  // the conversion is monotonic
+  int low = 0;
+  int high = ADC_CAL_LUT_SIZE - 1;
+  while (low < high)
+  {
+    int mid = (low + high) / 2;
+    if (adc_cal_lut[mid] < mv)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+float adc_cal_mv_per_count(int mv)
+{
+  // over 64 codes, a single code step is mostly 0 or 1 mV
+  const int half_span = 32;
+  int raw = adc_cal_mv_to_raw(mv);
+  int low = raw - half_span < 0 ? 0 : raw - half_span;
+  int high = raw + half_span >= ADC_CAL_LUT_SIZE ? ADC_CAL_LUT_SIZE - 1 : raw + half_span;
+  return (float)(adc_cal_lut[high] - adc_cal_lut[low]) / (high - low);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "stdbool.h"
+#include "stdint.h"
+
+// raw ADC reading to calibrated millivolts, one entry per 12 bit code
+// built from the eFuse calibration of the chip at init
+#define ADC_CAL_LUT_SIZE 4096
+
+extern uint16_t adc_cal_lut[ADC_CAL_LUT_SIZE];
+
+bool adc_cal_init(void);
+
+static inline uint16_t adc_cal_raw_to_mv(int raw)
+{
+  if (raw < 0)
+    raw = 0;
+  if (raw >= ADC_CAL_LUT_SIZE)
+    raw = ADC_CAL_LUT_SIZE - 1;
+  return adc_cal_lut[raw];
+}
+
+// lowest raw reading that converts to at least mv
+int adc_cal_mv_to_raw(int mv);
+// slope of the conversion around mv
+float adc_cal_mv_per_count(int mv);
@@ -0,0 +1,763 @@
+/**
+ * Micro benchmarks of the sensing pipeline hot paths
+ * Each call is timed on its own with the cycle counter, the cost of an
+ * empty call is measured once and subtracted
+ */
+#include "math.h"
+
+#include "mgos.h"
+#include "frozen.h"
+
+#include "bench.h"
+#include "sensor.h"
+#include "sensor_q16.h"
+#include "spsc_ring.h"
+#include "tank_volume.h"
+#include "tank_geometry.h"
+#include "tank_report.h"
+#include "adc_cal.h"
+#include "esp_adc_cal.h"
+
+#define TAG "Bench"
+
+#define BENCH_MAX_CASES 40
+
+static bench_case_t bench_cases[BENCH_MAX_CASES];
+static size_t bench_cases_count = 0;
+static bench_cycles_t bench_overhead_cycles = 0;
+
+// results go here so the compiler can not drop the work
+static volatile double bench_sink;
+static uint32_t bench_sample_counter = 0;
+
+// sample values cycling around the usual ADC readings
+static inline number_type bench_next_sample(void)
+{
+  return 400 + (bench_sample_counter++ & 0xff);
+}
+
+static void bench_empty(void *arg UNUSED_ARG)
+{
+}
+
+// same chain as pressure_adc in sensor_pressure.c
+static observable_value_t bench_pressure = {
+    .value.value = 0,
+    .name = "bench_pressure",
+    .filters = NULL,
+    .set = set_value,
+    .process = process_new_value,
+    .notify = notify_observers,
+};
+
+static filter_item_average_t bench_pressure_avg_filter = {
+    .super.filter = filter_item_average_fn,
+    .super.block_filter = filter_item_average_block_fn,
+    .number_of_samples = 50,
+    .sample_counter_ = 50,
+    .accumulator_ = 0,
+    .pass_first = false};
+
+static filter_item_exp_moving_average_t bench_pressure_ma_filter = {
+    .super.filter = filter_item_exp_moving_average_fn,
+    .super.block_filter = filter_item_exp_moving_average_block_fn,
+    .initialized = false,
+    .previous_value = 0,
+    .alpha = 0.8,
+    .pass_first = false};
+
+// same chain as tank_water_height in tank_volume.c
+static observable_value_t bench_tank = {
+    .value.value = 0,
+    .name = "bench_tank",
+    .filters = NULL,
+    .set = set_value,
+    .process = process_new_value,
+    .notify = notify_observers,
+};
+
+static filter_item_linear_fit_t bench_pressure_percentage_fit = {
+    .super.filter = filter_item_linear_fit_fn,
+    .super.block_filter = filter_item_linear_fit_block_fn,
+    .value_map = {{358, 0}, {605, 100}}};
+
+static filter_item_clamp_t bench_clamp_percentage = {
+    .super.filter = filter_item_clamp_fn,
+    .super.block_filter = filter_item_clamp_block_fn,
+    .min = 0,
+    .max = 100};
+
+static filter_item_linear_fit_t bench_percentage_water_height_fit = {
+    .super.filter = filter_item_linear_fit_fn,
+    .super.block_filter = filter_item_linear_fit_block_fn,
+    .value_map = {{0, 0}, {100, 50}}};
+
+// the same chains declared statically, tank fused into one kernel
+static filter_item_average_t bench_chain_avg_filter = {
+    .super.filter = filter_item_average_fn,
+    .super.block_filter = filter_item_average_block_fn,
+    .number_of_samples = 50,
+    .sample_counter_ = 50,
+    .accumulator_ = 0,
+    .pass_first = false};
+
+static filter_item_exp_moving_average_t bench_chain_ma_filter = {
+    .super.filter = filter_item_exp_moving_average_fn,
+    .super.block_filter = filter_item_exp_moving_average_block_fn,
+    .initialized = false,
+    .previous_value = 0,
+    .alpha = 0.8,
+    .pass_first = false};
+
+static filter_item_affine_clamp_t bench_chain_water_height_fit = {
+    .super.filter = filter_item_affine_clamp_fn,
+    .super.block_filter = filter_item_affine_clamp_block_fn};
+
+#define BENCH_PRESSURE_CHAIN(STAGE)        \
+  STAGE(average, bench_chain_avg_filter)   \
+  STAGE(exp_moving_average, bench_chain_ma_filter)
+
+#define BENCH_TANK_CHAIN(STAGE) \
+  STAGE(affine_clamp, bench_chain_water_height_fit)
+
+FILTER_CHAIN(bench_pressure_chain, BENCH_PRESSURE_CHAIN)
+FILTER_CHAIN(bench_tank_chain, BENCH_TANK_CHAIN)
+
+static observable_value_t bench_pressure_static = {
+    .value.value = 0,
+    .name = "pressure_static",
+    .chain = &bench_pressure_chain,
+    .filters = NULL,
+    .set = set_value,
+    .process = process_new_value,
+    .notify = notify_observers,
+};
+
+static observable_value_t bench_tank_static = {
+    .value.value = 0,
+    .name = "tank_static",
+    .chain = &bench_tank_chain,
+    .filters = NULL,
+    .set = set_value,
+    .process = process_new_value,
+    .notify = notify_observers,
+};
+
+// sliding window filters on their own
+static filter_item_sliding_mean_t bench_sliding_mean = {
+    .super.filter = filter_item_sliding_mean_fn,
+    .super.block_filter = filter_item_sliding_mean_block_fn,
+    .window_size = 16};
+
+static filter_item_moving_median_t bench_moving_median = {
+    .super.filter = filter_item_moving_median_fn,
+    .super.block_filter = filter_item_moving_median_block_fn,
+    .window_size = 9};
+
+static filter_item_hampel_t bench_hampel = {
+    .super.filter = filter_item_hampel_fn,
+    .super.block_filter = filter_item_hampel_block_fn,
+    .window_size = 9,
+    .threshold = 3,
+    .min_deviation = 20,
+    .replace = true};
+
+// 16 point calibration curve around the pressure samples
+static filter_item_calibration_t bench_calibration_linear = {
+    .super.filter = filter_item_calibration_fn,
+    .super.block_filter = filter_item_calibration_block_fn,
+    .monotone = false};
+
+static filter_item_calibration_t bench_calibration_monotone = {
+    .super.filter = filter_item_calibration_fn,
+    .super.block_filter = filter_item_calibration_block_fn,
+    .monotone = true};
+
+// drift model update with temperature and air pressure regressors
+static sensor_rls_t bench_rls;
+
+static void bench_rls_update(void *arg UNUSED_ARG)
+{
+  float x[2] = {(bench_sample_counter & 0xff) / 16.0f, (bench_sample_counter & 0x3f) / 8.0f};
+  bench_sink = sensor_rls_update(&bench_rls, x, 6 * x[0] + 0.5f * x[1] + (bench_sample_counter & 1));
+  bench_sample_counter++;
+}
+
+static sensor_window_regression_t bench_rate_regression;
+
+static void bench_rate_regression_add(void *arg UNUSED_ARG)
+{
+  number_type slope;
+  window_regression_add(&bench_rate_regression, bench_sample_counter * 2.5, 300 + (bench_sample_counter & 0x7));
+  window_regression_slope(&bench_rate_regression, &slope);
+  bench_sink = slope;
+  bench_sample_counter++;
+}
+
+// a counter reading through the task to mgos ring
+typedef struct bench_reading
+{
+  float frequency;
+  uint16_t count;
+  int64_t timestamp_us;
+} bench_reading_t;
+
+static bench_reading_t bench_ring_items[8];
+static spsc_ring_t bench_ring;
+
+static void bench_ring_consume(void *item, void *user_data UNUSED_ARG)
+{
+  bench_sink = ((bench_reading_t *)item)->frequency;
+}
+
+static void bench_ring_push_drain(void *arg UNUSED_ARG)
+{
+  bench_reading_t reading = {.frequency = bench_sample_counter & 0x1f, .count = bench_sample_counter, .timestamp_us = bench_sample_counter};
+  spsc_ring_push(&bench_ring, &reading);
+  spsc_ring_request_drain(&bench_ring);
+  spsc_ring_drain(&bench_ring, bench_ring_consume, NULL);
+  bench_sample_counter++;
+}
+
+// fixed point versions of both chains
+static observable_q16_t bench_pressure_q16 = {
+    .value.value = 0,
+    .name = "bench_pressure_q16",
+    .filters = NULL,
+    .set = set_value_q16,
+    .process = process_new_value_q16,
+    .notify = notify_observers_q16,
+};
+
+static filter_item_q16_average_t bench_pressure_avg_filter_q16 = {
+    .super.filter = filter_item_q16_average_fn,
+    .number_of_samples = 50,
+    .sample_counter_ = 50,
+    .accumulator_ = 0,
+    .pass_first = false};
+
+static filter_item_q16_exp_moving_average_t bench_pressure_ma_filter_q16 = {
+    .super.filter = filter_item_q16_exp_moving_average_fn,
+    .initialized = false,
+    .previous_value = 0,
+    .alpha = Q16_FROM_FLOAT(0.8),
+    .pass_first = false};
+
+static observable_q16_t bench_tank_q16 = {
+    .value.value = 0,
+    .name = "bench_tank_q16",
+    .filters = NULL,
+    .set = set_value_q16,
+    .process = process_new_value_q16,
+    .notify = notify_observers_q16,
+};
+
+static filter_item_q16_linear_fit_t bench_pressure_percentage_fit_q16 = {
+    .super.filter = filter_item_q16_linear_fit_fn,
+    .value_map = {{Q16_FROM_INT(358), 0}, {Q16_FROM_INT(605), Q16_FROM_INT(100)}}};
+
+static filter_item_q16_clamp_t bench_clamp_percentage_q16 = {
+    .super.filter = filter_item_q16_clamp_fn,
+    .min = 0,
+    .max = Q16_FROM_INT(100)};
+
+static filter_item_q16_linear_fit_t bench_percentage_water_height_fit_q16 = {
+    .super.filter = filter_item_q16_linear_fit_fn,
+    .value_map = {{0, 0}, {Q16_FROM_INT(100), Q16_FROM_INT(50)}}};
+
+// observers only, no filters
+static observable_value_t bench_observed = {
+    .value.value = 0,
+    .name = "bench_observed",
+    .filters = NULL,
+    .set = set_value,
+    .process = process_new_value,
+    .notify = notify_observers,
+};
+
+static void bench_observer(observable_value_t *this)
+{
+  bench_sink = this->value.value;
+}
+
+static void bench_set_value(void *arg)
+{
+  observable_value_t *ov = arg;
+  ov->process(ov, bench_next_sample());
+  bench_sink = ov->value.value;
+}
+
+// one ADC burst through the chain as a block and sample by sample
+static void bench_process_block(void *arg)
+{
+  observable_value_t *ov = arg;
+  number_type samples[SENSOR_BLOCK_SIZE];
+  for (size_t i = 0; i < SENSOR_BLOCK_SIZE; i++)
+    samples[i] = bench_next_sample();
+  process_new_values(ov, samples, SENSOR_BLOCK_SIZE);
+  bench_sink = ov->value.value;
+}
+
+static void bench_process_block_single(void *arg)
+{
+  observable_value_t *ov = arg;
+  number_type samples[SENSOR_BLOCK_SIZE];
+  for (size_t i = 0; i < SENSOR_BLOCK_SIZE; i++)
+    samples[i] = bench_next_sample();
+  for (size_t i = 0; i < SENSOR_BLOCK_SIZE; i++)
+    ov->process(ov, samples[i]);
+  bench_sink = ov->value.value;
+}
+
+// raw to millivolts, lookup table against the conversion it is built from
+static esp_adc_cal_characteristics_t bench_adc_characteristics;
+
+static void bench_adc_cal_lut(void *arg UNUSED_ARG)
+{
+  bench_sink = adc_cal_raw_to_mv(bench_next_sample());
+}
+
+static void bench_adc_cal_esp(void *arg UNUSED_ARG)
+{
+  bench_sink = esp_adc_cal_raw_to_voltage(bench_next_sample(), &bench_adc_characteristics);
+}
+
+static void bench_filter(void *arg)
+{
+  filter_item_t *fi = arg;
+  observable_number_t value_ = {
+      .value = bench_next_sample()};
+  fi->filter(fi, &value_);
+  bench_sink = value_.value;
+}
+
+static void bench_set_value_q16(void *arg)
+{
+  observable_q16_t *ov = arg;
+  ov->process(ov, Q16_FROM_INT(bench_next_sample()));
+  bench_sink = ov->value.value;
+}
+
+static void bench_notify_observers(void *arg)
+{
+  observable_value_t *ov = arg;
+  ov->notify(ov);
+}
+
+// the table lookup against the formulas it is built from
+static const tank_geometry_t bench_geometry = {
+    .shape = TANK_SHAPE_HORIZONTAL_CYLINDER,
+    .diameter_cm = 50,
+    .length_cm = 100};
+
+static void bench_tank_volume_liters(void *arg UNUSED_ARG)
+{
+  bench_sink = tank_volume_liters((bench_sample_counter++ & 0x3f) * 50.0f / 64);
+}
+
+static void bench_tank_volume_formula(void *arg)
+{
+  bench_sink = tank_geometry_exact_liters(arg, (bench_sample_counter++ & 0x3f) * 50.0f / 64);
+}
+
+// libm primitives of the volume formula, soft-float double vs single precision
+static void bench_acos(void *arg UNUSED_ARG)
+{
+  bench_sink = acos((bench_sample_counter++ & 0xff) / 256.0);
+}
+
+static void bench_acosf(void *arg UNUSED_ARG)
+{
+  bench_sink = acosf((bench_sample_counter++ & 0xff) / 256.0f);
+}
+
+static void bench_sqrt(void *arg UNUSED_ARG)
+{
+  bench_sink = sqrt(bench_next_sample());
+}
+
+static void bench_sqrtf(void *arg UNUSED_ARG)
+{
+  bench_sink = sqrtf((float)bench_next_sample());
+}
+
+static void bench_pow(void *arg UNUSED_ARG)
+{
+  bench_sink = pow(bench_next_sample(), 2);
+}
+
+static void bench_powf(void *arg UNUSED_ARG)
+{
+  bench_sink = powf((float)bench_next_sample(), 2);
+}
+
+static void bench_json(void *arg)
+{
+  const struct mbuf *(*serialize)(struct mbuf *) = arg;
+  static struct mbuf buffer = {0};
+  if (buffer.size == 0)
+    mbuf_init(&buffer, 1024);
+  buffer.len = 0;
+  serialize(&buffer);
+  bench_sink = buffer.len;
+}
+
+// unchanged report, the cache hit of every consumer after the first
+static void bench_json_cached(void *arg UNUSED_ARG)
+{
+  bench_sink = tank_report_status_json()->len;
+}
+
+bool bench_register(const char *name, bench_fn run, void *arg, uint32_t max_iterations)
+{
+  if (bench_cases_count == BENCH_MAX_CASES)
+  {
+    LOG(LL_ERROR, ("%s, no room for case %s", TAG, name));
+    return false;
+  }
+  bench_cases[bench_cases_count++] = (bench_case_t){
+      .name = name,
+      .run = run,
+      .arg = arg,
+      .max_iterations = max_iterations,
+  };
+  return true;
+}
+
+static void bench_measure(const bench_case_t *bench_case, uint32_t iterations, bench_result_t *result)
+{
+  *result = (bench_result_t){
+      .name = bench_case->name,
+      .iterations = 0,
+      .min = UINT32_MAX,
+      .max = 0,
+      .total = 0,
+  };
+  if (bench_case->max_iterations > 0 && iterations > bench_case->max_iterations)
+    iterations = bench_case->max_iterations;
+
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    bench_cycles_t start = bench_cycles();
+    bench_case->run(bench_case->arg);
+    bench_cycles_t elapsed = bench_cycles() - start;
+    elapsed = elapsed > bench_overhead_cycles ? elapsed - bench_overhead_cycles : 0;
+    if (elapsed < result->min)
+      result->min = elapsed;
+    if (elapsed > result->max)
+      result->max = elapsed;
+    result->total += elapsed;
+    result->iterations++;
+  }
+  if (result->iterations == 0)
+    result->min = 0;
+}
+
+static void bench_calibrate(void)
+{
+  bench_case_t empty = {
+      .name = "empty",
+      .run = bench_empty,
+  };
+  bench_result_t result;
+  bench_overhead_cycles = 0;
+  bench_measure(&empty, 1000, &result);
+  bench_overhead_cycles = result.min;
+}
+
+int bench_run(const char *prefix, uint32_t iterations, bench_result_cb cb, void *user_data)
+{
+  int cases_run = 0;
+  size_t prefix_len = prefix == NULL ? 0 : strlen(prefix);
+
+  bench_calibrate();
+  for (size_t i = 0; i < bench_cases_count; i++)
+  {
+    bench_result_t result;
+    if (prefix_len > 0 && strncmp(bench_cases[i].name, prefix, prefix_len) != 0)
+      continue;
+    bench_measure(&bench_cases[i], iterations, &result);
+    LOG(LL_DEBUG, ("%s, %s min %u max %u total %llu", TAG, result.name, (unsigned)result.min, (unsigned)result.max, (unsigned long long)result.total));
+    cb(&result, user_data);
+    cases_run++;
+  }
+  return cases_run;
+}
+
+bench_cycles_t bench_overhead(void)
+{
+  return bench_overhead_cycles;
+}
+
+uint32_t bench_cycles_per_us(void)
+{
+  return mgos_get_cpu_freq() / 1000000;
+}
+
+void bench_init(void)
+{
+  static bool initialized = false;
+  if (initialized)
+    return;
+  initialized = true;
+
+  filter_linear_fit_calc(&bench_pressure_percentage_fit);
+  filter_linear_fit_calc(&bench_percentage_water_height_fit);
+  filter_affine_clamp_fuse(&bench_chain_water_height_fit, &bench_pressure_percentage_fit,
+                           &bench_clamp_percentage, &bench_percentage_water_height_fit);
+  filter_q16_linear_fit_calc(&bench_pressure_percentage_fit_q16);
+  filter_q16_linear_fit_calc(&bench_percentage_water_height_fit_q16);
+
+  add_filter(&bench_pressure, (filter_item_t *)&bench_pressure_avg_filter);
+  add_filter(&bench_pressure, (filter_item_t *)&bench_pressure_ma_filter);
+  add_filter(&bench_tank, (filter_item_t *)&bench_pressure_percentage_fit);
+  add_filter(&bench_tank, (filter_item_t *)&bench_clamp_percentage);
+  add_filter(&bench_tank, (filter_item_t *)&bench_percentage_water_height_fit);
+  add_filter_q16(&bench_pressure_q16, (filter_item_q16_t *)&bench_pressure_avg_filter_q16);
+  add_filter_q16(&bench_pressure_q16, (filter_item_q16_t *)&bench_pressure_ma_filter_q16);
+  add_filter_q16(&bench_tank_q16, (filter_item_q16_t *)&bench_pressure_percentage_fit_q16);
+  add_filter_q16(&bench_tank_q16, (filter_item_q16_t *)&bench_clamp_percentage_q16);
+  add_filter_q16(&bench_tank_q16, (filter_item_q16_t *)&bench_percentage_water_height_fit_q16);
+  for (int i = 0; i < 4; i++)
+    add_observer(&bench_observed, bench_observer);
+  for (uint8_t i = 0; i < SENSOR_CALIBRATION_MAX_POINTS; i++)
+  {
+    bench_calibration_linear.x[i] = bench_calibration_monotone.x[i] = 350 + i * 20;
+    bench_calibration_linear.y[i] = bench_calibration_monotone.y[i] = i * i * 0.2;
+  }
+  bench_calibration_linear.points_count = bench_calibration_monotone.points_count = SENSOR_CALIBRATION_MAX_POINTS;
+  filter_calibration_calc(&bench_calibration_linear);
+  filter_calibration_calc(&bench_calibration_monotone);
+  sensor_rls_init(&bench_rls, 2, 0.9995, 1, NULL);
+  window_regression_init(&bench_rate_regression, 24);
+  spsc_ring_init(&bench_ring, bench_ring_items, sizeof(bench_ring_items[0]), 8);
+  adc_cal_init();
+  // the device keeps the table of its configured tank
+  if (tank_geometry_max_height_cm() == 0)
+    tank_geometry_init(&bench_geometry);
+  esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, 1100, &bench_adc_characteristics);
+
+  bench_register("set_value.pressure", bench_set_value, &bench_pressure, 0);
+  bench_register("set_value.tank", bench_set_value, &bench_tank, 0);
+  bench_register("set_value.pressure_static", bench_set_value, &bench_pressure_static, 0);
+  bench_register("set_value.tank_static", bench_set_value, &bench_tank_static, 0);
+  bench_register("set_value.pressure_q16", bench_set_value_q16, &bench_pressure_q16, 0);
+  bench_register("set_value.tank_q16", bench_set_value_q16, &bench_tank_q16, 0);
+  bench_register("block64.pressure", bench_process_block, &bench_pressure, 0);
+  bench_register("block64.pressure_single", bench_process_block_single, &bench_pressure, 0);
+  bench_register("block64.tank", bench_process_block, &bench_tank, 0);
+  bench_register("block64.tank_single", bench_process_block_single, &bench_tank, 0);
+  bench_register("filter.sliding_mean16", bench_filter, &bench_sliding_mean, 0);
+  bench_register("filter.moving_median9", bench_filter, &bench_moving_median, 0);
+  bench_register("filter.hampel9", bench_filter, &bench_hampel, 0);
+  bench_register("filter.calibration_linear", bench_filter, &bench_calibration_linear, 0);
+  bench_register("filter.calibration_monotone", bench_filter, &bench_calibration_monotone, 0);
+  bench_register("rls.update2", bench_rls_update, NULL, 0);
+  bench_register("rate.regression24", bench_rate_regression_add, NULL, 0);
+  bench_register("spsc.push_drain", bench_ring_push_drain, NULL, 0);
+  bench_register("notify_observers.4", bench_notify_observers, &bench_observed, 0);
+  bench_register("adc_cal.lut", bench_adc_cal_lut, NULL, 0);
+  bench_register("adc_cal.esp_adc_cal", bench_adc_cal_esp, NULL, 0);
+  bench_register("volume.liters", bench_tank_volume_liters, NULL, 0);
+  bench_register("volume.formula", bench_tank_volume_formula, (void *)&bench_geometry, 0);
+  bench_register("math.acos", bench_acos, NULL, 0);
+  bench_register("math.acosf", bench_acosf, NULL, 0);
+  bench_register("math.sqrt", bench_sqrt, NULL, 0);
+  bench_register("math.sqrtf", bench_sqrtf, NULL, 0);
+  bench_register("math.pow", bench_pow, NULL, 0);
+  bench_register("math.powf", bench_powf, NULL, 0);
+  bench_register("json.status", bench_json, (void *)getSatusAsJSON, 0);
+  bench_register("json.raw", bench_json, (void *)getRawAsJSON, 0);
+  bench_register("json.status_cached", bench_json_cached, NULL, 0);
+}
+
+// step response
+// tank thresholds 358..605 span 50 cm, 5 liters per cm at half height,
+// so one liter is about one ADC count
+#define BENCH_STEP_BASELINE 480.0
+#define BENCH_STEP_ADC 1.0
+#define BENCH_STEP_NOISE 8
+#define BENCH_STEP_SETTLE_S 20
+#define BENCH_STEP_TIMEOUT_S 60
+#define BENCH_STEP_NOISE_S 60
+// a fill, 20 liters per minute
+#define BENCH_STEP_RAMP_ADC_PER_S 0.33
+#define BENCH_STEP_RAMP_S 120
+
+typedef struct bench_step_chain bench_step_chain_t;
+struct bench_step_chain
+{
+  const char *name;
+  uint32_t rate_hz;
+  void (*setup)(observable_value_t *ov);
+};
+
+static filter_item_average_t bench_step_avg_filter;
+static filter_item_exp_moving_average_t bench_step_ma_filter;
+static filter_item_cic_t bench_step_cic_filter;
+static filter_item_kalman_level_t bench_step_kalman_filter;
+
+static observable_value_t bench_step_observable = {
+    .value.value = 0,
+    .name = "bench_step",
+    .filters = NULL,
+    .set = set_value,
+    .process = process_new_value,
+    .notify = notify_observers,
+};
+
+static struct
+{
+  uint32_t outputs;
+  double sum;
+  double sum_squares;
+} bench_step_outputs;
+
+static uint32_t bench_step_noise_state;
+
+// uniform in -BENCH_STEP_NOISE..BENCH_STEP_NOISE, same sequence every run
+static int bench_step_noise(void)
+{
+  bench_step_noise_state = bench_step_noise_state * 1664525u + 1013904223u;
+  return (int)((bench_step_noise_state >> 16) % (2 * BENCH_STEP_NOISE + 1)) - BENCH_STEP_NOISE;
+}
+
+static void bench_step_observer(observable_value_t *this)
+{
+  bench_step_outputs.outputs++;
+  bench_step_outputs.sum += this->value.value;
+  bench_step_outputs.sum_squares += this->value.value * this->value.value;
+}
+
+// same filters as the timer pipeline in sensor_pressure.c
+static void bench_step_avg_ma_setup(observable_value_t *ov)
+{
+  bench_step_avg_filter = (filter_item_average_t){
+      .super.filter = filter_item_average_fn,
+      .super.block_filter = filter_item_average_block_fn,
+      .number_of_samples = 50,
+      .sample_counter_ = 50};
+  bench_step_ma_filter = (filter_item_exp_moving_average_t){
+      .super.filter = filter_item_exp_moving_average_fn,
+      .super.block_filter = filter_item_exp_moving_average_block_fn,
+      .alpha = 0.8};
+  add_filter(ov, (filter_item_t *)&bench_step_avg_filter);
+  add_filter(ov, (filter_item_t *)&bench_step_ma_filter);
+}
+
+// same filter as PRESSURE_DECIMATION=1
+static void bench_step_cic_setup(observable_value_t *ov)
+{
+  bench_step_cic_filter = (filter_item_cic_t){
+      .super.filter = filter_item_cic_fn,
+      .super.block_filter = filter_item_cic_block_fn,
+      .order = 3,
+      .decimation = 640};
+  add_filter(ov, (filter_item_t *)&bench_step_cic_filter);
+}
+
+// same filter as PRESSURE_KALMAN=1
+static void bench_step_kalman_setup(observable_value_t *ov)
+{
+  bench_step_kalman_filter = (filter_item_kalman_level_t){
+      .super.filter = filter_item_kalman_level_fn,
+      .super.block_filter = filter_item_kalman_level_block_fn,
+      .dt = 0.05,
+      .process_noise = 0.002,
+      .measurement_noise = 25,
+      .overflow_noise_scale = 100,
+      .output_every = 10};
+  add_filter(ov, (filter_item_t *)&bench_step_kalman_filter);
+}
+
+static const bench_step_chain_t bench_step_chains[] = {
+    {.name = "avg50+ema 20Hz", .rate_hz = 20, .setup = bench_step_avg_ma_setup},
+    {.name = "cic3x640 1280Hz", .rate_hz = 1280, .setup = bench_step_cic_setup},
+    {.name = "kalman 20Hz", .rate_hz = 20, .setup = bench_step_kalman_setup},
+};
+
+static void bench_step_reset(const bench_step_chain_t *chain)
+{
+  observable_value_t *ov = &bench_step_observable;
+  ov->filters = NULL;
+  cleanup_observers(ov);
+  chain->setup(ov);
+  add_observer(ov, bench_step_observer);
+  memset(&bench_step_outputs, 0, sizeof(bench_step_outputs));
+  bench_step_noise_state = 1;
+}
+
+static void bench_step_measure(const bench_step_chain_t *chain, bench_step_result_t *result)
+{
+  observable_value_t *ov = &bench_step_observable;
+  uint32_t settle_samples = BENCH_STEP_SETTLE_S * chain->rate_hz;
+
+  result->name = chain->name;
+  result->rate_hz = chain->rate_hz;
+  result->step = BENCH_STEP_ADC;
+  result->input_noise = BENCH_STEP_NOISE / sqrtf(3);
+
+  // clean signal, settle then step
+  bench_step_reset(chain);
+  uint32_t warm_outputs = 0;
+  for (uint32_t i = 0; i < settle_samples; i++)
+  {
+    // output period from the second half, past any warm up
+    if (i == settle_samples / 2)
+      warm_outputs = bench_step_outputs.outputs;
+    ov->process(ov, BENCH_STEP_BASELINE);
+  }
+  warm_outputs = bench_step_outputs.outputs - warm_outputs;
+  result->output_period_ms = warm_outputs > 0 ? BENCH_STEP_SETTLE_S * 1000 / 2 / warm_outputs : 0;
+  uint32_t step_samples = 0;
+  while (step_samples < BENCH_STEP_TIMEOUT_S * chain->rate_hz)
+  {
+    ov->process(ov, BENCH_STEP_BASELINE + BENCH_STEP_ADC);
+    step_samples++;
+    if (ov->value.value >= BENCH_STEP_BASELINE + 0.9 * BENCH_STEP_ADC)
+      break;
+  }
+  result->latency_ms = (uint64_t)step_samples * 1000 / chain->rate_hz;
+
+  // clean ramp, lag of the last output behind the input
+  bench_step_reset(chain);
+  for (uint32_t i = 0; i < settle_samples; i++)
+    ov->process(ov, BENCH_STEP_BASELINE);
+  double ramp_input = BENCH_STEP_BASELINE;
+  for (uint32_t i = 0; i < BENCH_STEP_RAMP_S * chain->rate_hz; i++)
+  {
+    ramp_input = BENCH_STEP_BASELINE + BENCH_STEP_RAMP_ADC_PER_S * i / chain->rate_hz;
+    ov->process(ov, ramp_input);
+  }
+  result->ramp_lag_ms = (ramp_input - ov->value.value) / BENCH_STEP_RAMP_ADC_PER_S * 1000;
+
+  // noisy signal, output deviation after settling
+  bench_step_reset(chain);
+  for (uint32_t i = 0; i < settle_samples; i++)
+    ov->process(ov, BENCH_STEP_BASELINE + bench_step_noise());
+  memset(&bench_step_outputs, 0, sizeof(bench_step_outputs));
+  for (uint32_t i = 0; i < BENCH_STEP_NOISE_S * chain->rate_hz; i++)
+    ov->process(ov, BENCH_STEP_BASELINE + bench_step_noise());
+  result->output_noise = 0;
+  if (bench_step_outputs.outputs > 1)
+  {
+    double mean = bench_step_outputs.sum / bench_step_outputs.outputs;
+    double variance = bench_step_outputs.sum_squares / bench_step_outputs.outputs - mean * mean;
+    result->output_noise = variance > 0 ? sqrt(variance) : 0;
+  }
+
+  cleanup_observers(ov);
+  ov->filters = NULL;
+}
+
+int bench_step_run(bench_step_cb cb, void *user_data)
+{
+  size_t chains_count = sizeof(bench_step_chains) / sizeof(bench_step_chains[0]);
+  for (size_t i = 0; i < chains_count; i++)
+  {
+    bench_step_result_t result;
+    bench_step_measure(&bench_step_chains[i], &result);
+    cb(&result, user_data);
+  }
+  return chains_count;
+}
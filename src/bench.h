@@ -0,0 +1,81 @@
+#pragma once
+
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+#include "time.h"
+
+// cycles are counted in 32 bits, at 240MHz this wraps every ~17s
+// which is plenty for timing a single call
+typedef uint32_t bench_cycles_t;
+
+static inline bench_cycles_t bench_cycles(void)
+{
+#if defined(__XTENSA__)
+  bench_cycles_t ccount;
+  __asm__ __volatile__("rsr %0, ccount" : "=a"(ccount));
+  return ccount;
+#elif defined(__x86_64__) || defined(__i386__)
+  return (bench_cycles_t)__builtin_ia32_rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (bench_cycles_t)ts.tv_nsec;
+#endif
+}
+
+typedef void (*bench_fn)(void *arg);
+
+typedef struct bench_case bench_case_t;
+struct bench_case
+{
+  const char *name;
+  bench_fn run;
+  void *arg;
+  // cap for cases with side effects, 0 for none
+  uint32_t max_iterations;
+};
+
+typedef struct bench_result bench_result_t;
+struct bench_result
+{
+  const char *name;
+  uint32_t iterations;
+  bench_cycles_t min;
+  bench_cycles_t max;
+  uint64_t total;
+};
+
+typedef void (*bench_result_cb)(const bench_result_t *result, void *user_data);
+
+// registers the hot path cases of the sensing pipeline
+void bench_init(void);
+bool bench_register(const char *name, bench_fn run, void *arg, uint32_t max_iterations);
+// run each case whose name starts with prefix, NULL or "" for all
+// returns the number of cases run
+int bench_run(const char *prefix, uint32_t iterations, bench_result_cb cb, void *user_data);
+// measured cost of an empty call, already subtracted from the results
+bench_cycles_t bench_overhead(void);
+uint32_t bench_cycles_per_us(void);
+
+// step response of the pressure filter chains at their own sample rates
+// latency to 90% of a 1 liter step on a clean signal, lag behind a clean
+// 20 liters per minute fill, output noise on a signal with uniform ADC
+// noise, both in ADC counts
+typedef struct bench_step_result bench_step_result_t;
+struct bench_step_result
+{
+  const char *name;
+  uint32_t rate_hz;
+  uint32_t output_period_ms;
+  uint32_t latency_ms;
+  uint32_t ramp_lag_ms;
+  float step;
+  float input_noise;
+  float output_noise;
+};
+
+typedef void (*bench_step_cb)(const bench_step_result_t *result, void *user_data);
+
+// blocks for the whole simulation, about a second on the device
+int bench_step_run(bench_step_cb cb, void *user_data);
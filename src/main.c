@@ -14,12 +14,22 @@
 #include "mgos_mqtt.h"
 #include "mgos_bme280.h"
 #include "mgos_neopixel.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
 
 #include "sensor_bme280.h"
 #include "sensor_pressure.h"
 #include "sensor_counter.h"
 #include "tank_volume.h"
-//#include "sensor.h"
+#include "tank_geometry.h"
+#include "tank_autocal.h"
+#include "tank_drift.h"
+#include "tank_totalizer.h"
+#include "tank_report.h"
+#if BENCH_MODE==1
+#include "bench.h"
+#endif
+#include "sensor.h"
 
 #define TAG "Tank sensor main unit"
 
@@ -30,15 +40,18 @@ enum WS_ENDPOINTS
   WS_ENDPOINT_RAW
 };
 
-// notify timer
+// notify timer, one repeating timer checks the time since the last status
+// instead of a one shot timer allocated for every notification
 static const int notify_timer_period_msec = 3000;
-static mgos_timer_id notify_timer_id = MGOS_INVALID_TIMER_ID;
+static const int notify_timer_tick_msec = 500;
+static int64_t last_status_notify_us = 0;
 
 // tank volume
-static const float tank_maximum_liters = 197.0;
 // threshold values for reporting full or empty status
 static float liters_low_value = -1;
 static float liters_high_value = -1;
+// false with a bad tank.totalizer.k_factor, the volume is not reported
+static bool totalizer_running = false;
 
 // pressure
 static int pressure_low_value = -1;
@@ -50,7 +63,14 @@ static const int max_freq_thr_hz = 200;
 
 static const char *JSON_HEADERS = "Connection: close\r\nContent-Type: application/json";
 static const char *pressure_limits_fmt = "{low_thr:%i, high_thr:%i}";
+// pressure thresholds are in calibrated millivolts with PRESSURE_MILLIVOLTS=1
+#if PRESSURE_MILLIVOLTS==1
+#define PRESSURE_LIMIT_MAX 3300
+#else
+#define PRESSURE_LIMIT_MAX 4096
+#endif
 static const char *tank_limits_fmt = "{low_thr:%f, high_thr:%f}";
+static const char *calibration_capture_fmt = "{height_cm:%f}";
 static const char *freq_thr_fmt = "{freq_thr:%i}";
 
 const uint8_t RGB_PIN = 5;
@@ -64,120 +84,22 @@ typedef enum notify_type
   NOTIFY_STATUS
 } notify_type_t;
 
-typedef enum tank_status
-{
-  TANK_LOW = 0,
-  TANK_NORMAL,
-  TANK_FULL,
-} tank_status_t;
-
-char *status_text[] = {
-    [TANK_LOW] = "low",
-    [TANK_NORMAL] = "normal",
-    [TANK_FULL] = "full"};
-
-struct sensor_info
-{
-  time_t timestamp;
-  double air_temperature;
-  double air_pressure;
-  double air_humidity;
-  tank_status_t tank_status;
-  bool tank_overflow;
-  float tank_liters;
-  float tank_percentage;
-} sensor_info = {
-    .timestamp = 0,
-    .air_temperature = 0.0,
-    .air_pressure = 0.0,
-    .air_humidity = 0.0,
-    .tank_status = TANK_LOW,
-    .tank_overflow = false,
-    .tank_liters = 0.0,
-    .tank_percentage = 0.0
-};
-
-struct sensor_raw
-{
-  time_t    timestamp;
-  uint16_t  tank_pressure_adc;
-  uint16_t  counter_count;
-  float     counter_frequency;
-} sensor_raw = {
-  .timestamp          = 0,
-  .tank_pressure_adc  = 0,
-  .counter_count      = 0,
-  .counter_frequency  = 0
-};
-
 static void notify_listeners(notify_type_t notify_reason);
 
 // deferred cleanup
-void cleanup_post_data(char **buffer) {
-  if(*buffer != NULL) free(*buffer);
-}
-
 void cleanup_mbuf(struct mbuf *buffer) {
   if(buffer != NULL) mbuf_free(buffer);
 }
 
-// caller has to dispose of memory
-const struct mbuf *getSatusAsJSON(struct mbuf *buffer)
-{
-  struct json_out json_result = JSON_OUT_MBUF(buffer);
-  // mbuf_init(buffer, 1024);
-  json_printf(&json_result,
-              "{"
-              "timestamp: %d,"
-              "air_temperature: %4.2f,"
-              "air_pressure: %5.1f,"
-              "air_humidity: %4.1f,"
-              "tank_liters: %4.1f,"
-              "tank_percentage: %3.1f,"
-              "tank_status: \"%s\","
-              "tank_overflow: %B"
-              "}",
-              sensor_info.timestamp,
-              sensor_info.air_temperature,
-              sensor_info.air_pressure,
-              sensor_info.air_humidity,
-              sensor_info.tank_liters,
-              sensor_info.tank_percentage,
-              status_text[sensor_info.tank_status],
-              sensor_info.tank_overflow);
-  return buffer;
-}
-
-const struct mbuf *getRawAsJSON(struct mbuf *buffer)
-{
-  struct json_out json_result = JSON_OUT_MBUF(buffer);
-  // mbuf_init(buffer, 1024);
-  json_printf(  &json_result,
-                "{"
-                "timestamp: %d,"
-                "tank_pressure_adc: %d,"
-                "tank_overflow_count: %d,"
-                "tank_overflow_frequency: %3.1f"
-                "}",
-                sensor_raw.timestamp,
-                sensor_raw.tank_pressure_adc,
-                sensor_raw.counter_count,
-                sensor_raw.counter_frequency
-                );
-  return buffer;
-}
-
 static void rpc_status_handler(struct mg_rpc_request_info *ri, void *cb_arg UNUSED_ARG,
                                struct mg_rpc_frame_info *fi UNUSED_ARG, struct mg_str args)
 {
   LOG(LL_DEBUG, ("RPC: Status requested"));
-  struct mbuf response_buffer __attribute__((__cleanup__(cleanup_mbuf)));
-  mbuf_init(&response_buffer, 1024);
-  getSatusAsJSON(&response_buffer);
+  const struct mbuf *response_buffer = tank_report_status_json();
 
-  if (response_buffer.len > 0)
+  if (response_buffer->len > 0)
   {
-    mg_rpc_send_responsef(ri, "%.*s", response_buffer.len, response_buffer.buf);
+    mg_rpc_send_responsef(ri, "%.*s", response_buffer->len, response_buffer->buf);
   }
   else
   {
@@ -199,20 +121,19 @@ static void http_handler(struct mg_connection *c, int ev, void *p, void *user_da
     return;
   LOG(LL_DEBUG, ("HTTP: Status requested"));
 
-  struct mbuf response_buffer __attribute__((__cleanup__(cleanup_mbuf)));
-  mbuf_init(&response_buffer, 1024);
+  const struct mbuf *response_buffer = NULL;
 
   if(strncmp(mgos_sys_config_get_http_status_url(), hm->uri.p, hm->uri.len) == 0) {
-    getSatusAsJSON(&response_buffer);
+    response_buffer = tank_report_status_json();
   }
   if(strncmp(mgos_sys_config_get_http_raw_url(), hm->uri.p, hm->uri.len) == 0) {
-    getRawAsJSON(&response_buffer);
+    response_buffer = tank_report_raw_json();
   }
 
-  if (response_buffer.len > 0)
+  if (response_buffer != NULL && response_buffer->len > 0)
   {
-    mg_send_head(c, 200, response_buffer.len, JSON_HEADERS);
-    mg_send(c, response_buffer.buf, response_buffer.len);
+    mg_send_head(c, 200, response_buffer->len, JSON_HEADERS);
+    mg_send(c, response_buffer->buf, response_buffer->len);
   }
   else
   {
@@ -224,6 +145,8 @@ static void http_handler(struct mg_connection *c, int ev, void *p, void *user_da
 
 static void notify_timer_callback(void *ud)
 {
+  if (mgos_uptime_micros() - last_status_notify_us < notify_timer_period_msec * 1000LL)
+    return;
   LOG(LL_INFO, ("Notify timer called"));
   notify_listeners(NOTIFY_TIMER);
 }
@@ -253,7 +176,7 @@ static void wh_ev_handler(struct mg_connection *c, int ev, void *p, void *user_d
 	}
 }
 
-static void notify_webhook(const char *webhook_url, char *post_data)
+static void notify_webhook(const char *webhook_url, const char *post_data)
 {
   static bool http_client_active = false;
   if(http_client_active == true) {
@@ -271,25 +194,26 @@ static void notify_listeners(notify_type_t notify_reason)
 {
   struct mg_mgr *mgr = mgos_get_mgr();
   
-  struct mbuf response_buffer __attribute__((__cleanup__(cleanup_mbuf)));
-  struct mbuf response_raw_buffer __attribute__((__cleanup__(cleanup_mbuf)));
-
   static time_t last_notify_timestamp;
 
   if(notify_reason != NOTIFY_RAW) {
-    mgos_clear_timer(notify_timer_id);
-  }
-
-  if(last_notify_timestamp == sensor_info.timestamp) {
-    sensor_info.timestamp = time(NULL);
+    last_status_notify_us = mgos_uptime_micros();
   }
-  last_notify_timestamp = sensor_info.timestamp;
 
-  mbuf_init(&response_buffer, 1024);
-  getSatusAsJSON(&response_buffer);
+  tank_report_refresh_timestamp(&last_notify_timestamp);
 
-  mbuf_init(&response_raw_buffer, 1024);
-  getRawAsJSON(&response_raw_buffer);
+  // only the published kind is serialized, and only if it changed
+  const struct mbuf *response_buffer = NULL;
+  const struct mbuf *response_raw_buffer = NULL;
+  if(notify_reason != NOTIFY_RAW) {
+    response_buffer = tank_report_status_json();
+  } else {
+    response_raw_buffer = tank_report_raw_json();
+  }
+  // did not fit its arena slot, counted in Device.Heap
+  if ((response_buffer != NULL && response_buffer->len == 0) ||
+      (response_raw_buffer != NULL && response_raw_buffer->len == 0))
+    return;
 
 #ifdef MGOS_CONFIG_HAVE_MQTT_STATUS_TOPIC
   // MQTT notify
@@ -297,11 +221,11 @@ static void notify_listeners(notify_type_t notify_reason)
     goto notify_http;
 
   if(notify_reason != NOTIFY_RAW) {
-    mgos_mqtt_pub(mgos_sys_config_get_mqtt_status_topic(), response_buffer.buf, response_buffer.len, 1, false);
+    mgos_mqtt_pub(mgos_sys_config_get_mqtt_status_topic(), response_buffer->buf, response_buffer->len, 1, false);
   }
 
   if(notify_reason == NOTIFY_RAW) {
-    mgos_mqtt_pub(mgos_sys_config_get_mqtt_raw_topic(), response_raw_buffer.buf, response_raw_buffer.len, 1, false);
+    mgos_mqtt_pub(mgos_sys_config_get_mqtt_raw_topic(), response_raw_buffer->buf, response_raw_buffer->len, 1, false);
   }
 
   notify_http:
@@ -312,11 +236,11 @@ static void notify_listeners(notify_type_t notify_reason)
   {
     if((c->flags & MG_F_IS_WEBSOCKET) == 0) continue;
     if((int)c->user_data == WS_ENDPOINT_STATUS && notify_reason != NOTIFY_RAW) {
-      mg_send_websocket_frame(c, WEBSOCKET_OP_TEXT | WEBSOCKET_OP_CONTINUE, response_buffer.buf, response_buffer.len);
+      mg_send_websocket_frame(c, WEBSOCKET_OP_TEXT | WEBSOCKET_OP_CONTINUE, response_buffer->buf, response_buffer->len);
     }
 
     if((int)c->user_data == WS_ENDPOINT_RAW && notify_reason == NOTIFY_RAW) {
-      mg_send_websocket_frame(c, WEBSOCKET_OP_TEXT | WEBSOCKET_OP_CONTINUE, response_raw_buffer.buf, response_raw_buffer.len);
+      mg_send_websocket_frame(c, WEBSOCKET_OP_TEXT | WEBSOCKET_OP_CONTINUE, response_raw_buffer->buf, response_raw_buffer->len);
     }
 
   }
@@ -327,89 +251,122 @@ static void notify_listeners(notify_type_t notify_reason)
   if (webhook_url == NULL) goto notify_out;
   LOG(LL_INFO, ("Notify WebHook URL:  %s", webhook_url));
 
-  char *post_data __attribute__ ((__cleanup__(cleanup_post_data))) = malloc(response_buffer.len + 1);
-  strncpy(post_data, response_buffer.buf, response_buffer.len);
-  post_data[response_buffer.len] = '\0';
-  notify_webhook(webhook_url, post_data);
+  // the cached payload is terminated, mongoose copies it into the request
+  const struct mbuf *webhook_payload = tank_report_status_json();
+  if (webhook_payload->len == 0) goto notify_out;
+  notify_webhook(webhook_url, webhook_payload->buf);
 
   notify_out:
+  return;
 #endif
+}
 
-  notify_timer_id = mgos_set_timer(notify_timer_period_msec, 0, notify_timer_callback, NULL);
+#if SENSING_TASK==1
+static void notify_listeners_cb(void *arg)
+{
+  notify_listeners((notify_type_t)(intptr_t)arg);
 }
 
+// the pressure and volume events come from the sensing task, the network
+// is only used from the mgos task
+static void notify_listeners_from_pipeline(notify_type_t notify_reason)
+{
+  mgos_invoke_cb(notify_listeners_cb, (void *)(intptr_t)notify_reason, false);
+}
+#else
+static void notify_listeners_from_pipeline(notify_type_t notify_reason)
+{
+  notify_listeners(notify_reason);
+}
+#endif
+
 static void bme280_cb(int ev, void *evd, void *user_data UNUSED_ARG)
 {
   if(ev != ENV_MEASUREMENT) return;
   struct mgos_bme280_data *environment_status = evd;
   LOG(LL_DEBUG, ("[BME read] temp %f, press %f, humid %f", environment_status->temp, environment_status->press, environment_status->humid));
-  sensor_info.timestamp = time(NULL);
-  sensor_info.air_temperature = environment_status->temp;
-  sensor_info.air_pressure = environment_status->press;
-  sensor_info.air_humidity = environment_status->humid;
+  tank_report_set_environment(environment_status->temp, environment_status->press, environment_status->humid);
 }
 
 static void pressure_cb(int ev, void *evd, void *user_data UNUSED_ARG)
 {
   // skip anything but pressure measurement
   if(ev != PRESSURE_MEASUREMENT) return;
-  pressure_status_t *pressure_status = evd;
-  sensor_raw.timestamp = time(NULL);
-  sensor_raw.tank_pressure_adc = pressure_status->raw_adc;
-  notify_listeners(NOTIFY_RAW);
+  tank_report_set_pressure((pressure_status_t *)evd);
+  notify_listeners_from_pipeline(NOTIFY_RAW);
 }
 
 static void tank_volume_cb(int ev, void *evd, void *user_data UNUSED_ARG)
 {
   // skip anything but valid measurements
   if(ev != VOLUME_MEASUREMENT) return;
-  tank_volume_t *tank_volume_measurement = (tank_volume_t *)evd;
-  sensor_info.timestamp = time(NULL);
-  sensor_info.tank_liters = tank_volume_measurement->tank_liters;
-  sensor_info.tank_percentage = tank_volume_measurement->tank_percentage;
+  // within the sample, the liters thresholds are changed under its lock
+  tank_report_set_volume((tank_volume_t *)evd, liters_low_value, liters_high_value);
+  notify_listeners_from_pipeline(NOTIFY_STATUS);
+}
 
-  // text key representing status will be added in the
-  // JSON preparation function
+// latency of the overflow alarm, from the first pulse of the window to
+// the alarm interrupt and from the interrupt to the queued notifications
+typedef struct alarm_latency
+{
+  uint32_t count;
+  int64_t last_us;
+  int64_t min_us;
+  int64_t max_us;
+  int64_t total_us;
+} alarm_latency_t;
 
-  tank_status_t tank_status = TANK_NORMAL;
-  if (sensor_info.tank_liters < liters_low_value)
-  {
-    tank_status = TANK_LOW;
-  }
-  if (sensor_info.tank_liters > liters_high_value)
-  {
-    tank_status = TANK_FULL;
-  }
-  sensor_info.tank_status = tank_status;
+static alarm_latency_t alarm_pulse_latency;
+static alarm_latency_t alarm_publish_latency;
 
+static void alarm_latency_add(alarm_latency_t *latency, int64_t us)
+{
+  if (latency->count == 0 || us < latency->min_us)
+    latency->min_us = us;
+  if (latency->count == 0 || us > latency->max_us)
+    latency->max_us = us;
+  latency->last_us = us;
+  latency->total_us += us;
+  latency->count++;
+}
+
+static int alarm_latency_to_json(struct json_out *out, const char *name, const alarm_latency_t *latency)
+{
+  return json_printf(out, "%Q:{last_us:%d, min_us:%d, max_us:%d, mean_us:%d}", name,
+                     (int)latency->last_us, (int)latency->min_us, (int)latency->max_us,
+                     latency->count > 0 ? (int)(latency->total_us / latency->count) : 0);
+}
+
+// fast path, publish the overflow without waiting for the end of the gate
+static void counter_alarm_cb(const counter_alarm_t *counter_alarm)
+{
+  if (!tank_report_set_overflow_alarm()) return;
   notify_listeners(NOTIFY_STATUS);
+
+  // the clock of the alarm ISR
+  int64_t published_us = esp_timer_get_time();
+  alarm_latency_add(&alarm_pulse_latency, counter_alarm->alarm_us - counter_alarm->first_pulse_us);
+  alarm_latency_add(&alarm_publish_latency, published_us - counter_alarm->alarm_us);
+  LOG(LL_INFO, ("COUNTER: Overflow alarm, pulse to alarm %d us, alarm to publish %d us",
+                (int)alarm_pulse_latency.last_us, (int)alarm_publish_latency.last_us));
 }
 
 static void counter_cb(int ev, void *evd, void *user_data UNUSED_ARG)
 {
+  if(ev == COUNTER_OVERFLOW_ALARM)
+  {
+    counter_alarm_cb((const counter_alarm_t *)evd);
+    return;
+  }
   if(ev != COUNTER_CHANGE) return;
 
   gpio_counter_t *gpio_counter = evd;
-  LOG(LL_DEBUG, ("COUNTER: Count %d, Frequency %d", gpio_counter->count, gpio_counter->frequency));
-
-  if (sensor_raw.counter_count == gpio_counter->count && sensor_raw.counter_frequency == gpio_counter->frequency) return;
+  LOG(LL_DEBUG, ("COUNTER: Count %d, Frequency %.2f", gpio_counter->count, gpio_counter->frequency));
 
-  sensor_raw.timestamp = time(NULL);
-  sensor_raw.counter_count = gpio_counter->count;
-  sensor_raw.counter_frequency = gpio_counter->frequency;
+  if (!tank_report_set_counter(gpio_counter)) return;
   notify_listeners(NOTIFY_RAW);
 
-  if(freq_thr_hz == 0) return;
-
-  bool tank_overflow = false;
-  if (gpio_counter->frequency >= freq_thr_hz)
-  {
-    tank_overflow = true;
-  }
-  if(sensor_info.tank_overflow == tank_overflow) return;
-  
-  sensor_info.timestamp = time(NULL);
-  sensor_info.tank_overflow = tank_overflow;
+  if (!tank_report_set_overflow(gpio_counter, freq_thr_hz)) return;
   notify_listeners(NOTIFY_STATUS);
 }
 
@@ -429,14 +386,19 @@ static void pressure_set_limits_handler(struct mg_rpc_request_info *ri, void *cb
   }
   LOG(LL_INFO, ("%s, [Pressure limits] low: %d, high: %d", TAG, low_pressure_adc_val, high_pressure_adc_val));
 
-  if (low_pressure_adc_val < 0 || high_pressure_adc_val > 4096 || low_pressure_adc_val > high_pressure_adc_val)
+  if (low_pressure_adc_val < 0 || high_pressure_adc_val > PRESSURE_LIMIT_MAX || low_pressure_adc_val > high_pressure_adc_val)
   {
-    mg_rpc_send_errorf(ri, 500, "Invalid values. low_thr can not be less than 0, high_thr can not be more than 4096, low_thr can not be more than high_thr");
+    mg_rpc_send_errorf(ri, 500, "Invalid values. low_thr can not be less than 0, high_thr can not be more than %d, low_thr can not be more than high_thr", PRESSURE_LIMIT_MAX);
     return;
   }
 
+#if PRESSURE_MILLIVOLTS==1
+  mgos_sys_config_set_tank_mv_pressure_low_threshold(low_pressure_adc_val);
+  mgos_sys_config_set_tank_mv_pressure_high_threshold(high_pressure_adc_val);
+#else
   mgos_sys_config_set_tank_adc_pressure_low_threshold(low_pressure_adc_val);
   mgos_sys_config_set_tank_adc_pressure_high_threshold(high_pressure_adc_val);
+#endif
 
   char **msg = &(char *){0};
   if (save_cfg(&mgos_sys_config, msg))
@@ -445,6 +407,7 @@ static void pressure_set_limits_handler(struct mg_rpc_request_info *ri, void *cb
     pressure_high_value = high_pressure_adc_val;
     mg_rpc_send_responsef(ri, "{status:%B}", true);
     tank_volume_set_threshold(pressure_low_value, pressure_high_value);
+    tank_autocal_reset(pressure_low_value, pressure_high_value);
   }
   else
   {
@@ -457,6 +420,7 @@ static void pressure_set_limits_handler(struct mg_rpc_request_info *ri, void *cb
 static void tank_set_limits_handler(struct mg_rpc_request_info *ri, void *cb_arg UNUSED_ARG,
                                     struct mg_rpc_frame_info *fi UNUSED_ARG, struct mg_str args)
 {
+  float tank_maximum_liters = tank_geometry_max_liters();
   float low_liters_val = 0, high_liters_val = tank_maximum_liters;
   if (json_scanf(args.p, args.len,
                  ri->args_fmt,
@@ -481,8 +445,11 @@ static void tank_set_limits_handler(struct mg_rpc_request_info *ri, void *cb_arg
   char **msg = &(char *){0};
   if (save_cfg(&mgos_sys_config, msg))
   {
+    // read as a pair by the sample, on the sensing task with SENSING_TASK=1
+    sensor_pressure_lock();
     liters_low_value = low_liters_val;
     liters_high_value = high_liters_val;
+    sensor_pressure_unlock();
     mg_rpc_send_responsef(ri, "{status:%B}", true);
   }
   else
@@ -492,6 +459,80 @@ static void tank_set_limits_handler(struct mg_rpc_request_info *ri, void *cb_arg
   free(*msg);
 }
 
+// thresholds learned from fill cycles
+static void pressure_autocal_handler(struct mg_rpc_request_info *ri, void *cb_arg UNUSED_ARG,
+                                     struct mg_rpc_frame_info *fi UNUSED_ARG, struct mg_str args UNUSED_ARG)
+{
+  struct mbuf response_buffer __attribute__((__cleanup__(cleanup_mbuf)));
+  mbuf_init(&response_buffer, 256);
+  struct json_out out = JSON_OUT_MBUF(&response_buffer);
+  tank_autocal_to_json(&out);
+  mg_rpc_send_responsef(ri, "%.*s", response_buffer.len, response_buffer.buf);
+}
+
+// temperature compensation learned while the level is static
+static void pressure_drift_handler(struct mg_rpc_request_info *ri, void *cb_arg UNUSED_ARG,
+                                   struct mg_rpc_frame_info *fi UNUSED_ARG, struct mg_str args UNUSED_ARG)
+{
+  struct mbuf response_buffer __attribute__((__cleanup__(cleanup_mbuf)));
+  mbuf_init(&response_buffer, 256);
+  struct json_out out = JSON_OUT_MBUF(&response_buffer);
+  tank_drift_to_json(&out);
+  mg_rpc_send_responsef(ri, "%.*s", response_buffer.len, response_buffer.buf);
+}
+
+// capture calibration points during a controlled fill and apply them
+static void calibration_send_response(struct mg_rpc_request_info *ri)
+{
+  struct mbuf response_buffer __attribute__((__cleanup__(cleanup_mbuf)));
+  mbuf_init(&response_buffer, 512);
+  struct json_out out = JSON_OUT_MBUF(&response_buffer);
+  tank_volume_calibration_to_json(&out);
+  mg_rpc_send_responsef(ri, "%.*s", response_buffer.len, response_buffer.buf);
+}
+
+static void calibration_get_handler(struct mg_rpc_request_info *ri, void *cb_arg UNUSED_ARG,
+                                    struct mg_rpc_frame_info *fi UNUSED_ARG, struct mg_str args UNUSED_ARG)
+{
+  calibration_send_response(ri);
+}
+
+static void calibration_capture_handler(struct mg_rpc_request_info *ri, void *cb_arg UNUSED_ARG,
+                                        struct mg_rpc_frame_info *fi UNUSED_ARG, struct mg_str args)
+{
+  float height_cm = -1;
+  if (json_scanf(args.p, args.len, ri->args_fmt, &height_cm) < 1)
+  {
+    mg_rpc_send_errorf(ri, 500, "Bad request. Expected {\"height_cm\":N}");
+    return;
+  }
+  if (!tank_volume_calibration_capture(height_cm))
+  {
+    mg_rpc_send_errorf(ri, 500, "Could not capture. height_cm in [0..%.1f], at most %d points, after the first pressure reading",
+                       tank_geometry_max_height_cm(), SENSOR_CALIBRATION_MAX_POINTS);
+    return;
+  }
+  calibration_send_response(ri);
+}
+
+static void calibration_apply_handler(struct mg_rpc_request_info *ri, void *cb_arg UNUSED_ARG,
+                                      struct mg_rpc_frame_info *fi UNUSED_ARG, struct mg_str args UNUSED_ARG)
+{
+  if (!tank_volume_calibration_apply(mgos_sys_config_get_tank_calibration_file()))
+  {
+    mg_rpc_send_errorf(ri, 500, "Could not apply. At least 2 points with the pressure rising with the height are needed");
+    return;
+  }
+  calibration_send_response(ri);
+}
+
+static void calibration_reset_handler(struct mg_rpc_request_info *ri, void *cb_arg UNUSED_ARG,
+                                      struct mg_rpc_frame_info *fi UNUSED_ARG, struct mg_str args UNUSED_ARG)
+{
+  tank_volume_calibration_reset(mgos_sys_config_get_tank_calibration_file());
+  calibration_send_response(ri);
+}
+
 // control counter, set threshold
 static void counter_stop_handler(struct mg_rpc_request_info *ri, void *cb_arg UNUSED_ARG,
                                  struct mg_rpc_frame_info *fi UNUSED_ARG, struct mg_str args UNUSED_ARG)
@@ -507,6 +548,57 @@ static void counter_start_handler(struct mg_rpc_request_info *ri, void *cb_arg U
   mg_rpc_send_responsef(ri, "{status:%B}", success);
 }
 
+// used high water and fragmentation, the share of the free heap outside
+// the largest free block
+static void heap_handler(struct mg_rpc_request_info *ri, void *cb_arg UNUSED_ARG,
+                         struct mg_rpc_frame_info *fi UNUSED_ARG, struct mg_str args UNUSED_ARG)
+{
+  size_t heap_size = mgos_get_heap_size();
+  size_t free_heap = mgos_get_free_heap_size();
+  size_t min_free_heap = mgos_get_min_free_heap_size();
+  size_t largest_free_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  float fragmentation = free_heap > 0 ? 100.0f * (1.0f - (float)largest_free_block / free_heap) : 0;
+
+  struct mbuf response_buffer __attribute__((__cleanup__(cleanup_mbuf)));
+  mbuf_init(&response_buffer, 256);
+  struct json_out out = JSON_OUT_MBUF(&response_buffer);
+  json_printf(&out, "{size:%u, free:%u, min_free:%u, used_high_water:%u, largest_free_block:%u, fragmentation:%.1f, payload:",
+              (unsigned)heap_size, (unsigned)free_heap, (unsigned)min_free_heap,
+              (unsigned)(heap_size - min_free_heap), (unsigned)largest_free_block, fragmentation);
+  tank_report_payload_to_json(&out);
+  json_printf(&out, "}");
+  mg_rpc_send_responsef(ri, "%.*s", response_buffer.len, response_buffer.buf);
+}
+
+static void counter_totalizer_handler(struct mg_rpc_request_info *ri, void *cb_arg UNUSED_ARG,
+                                      struct mg_rpc_frame_info *fi UNUSED_ARG, struct mg_str args UNUSED_ARG)
+{
+  if (!totalizer_running)
+  {
+    mg_rpc_send_errorf(ri, 503, "Totalizer not running, check tank.totalizer.k_factor");
+    return;
+  }
+  struct mbuf response_buffer __attribute__((__cleanup__(cleanup_mbuf)));
+  mbuf_init(&response_buffer, 128);
+  struct json_out out = JSON_OUT_MBUF(&response_buffer);
+  tank_totalizer_to_json(&out);
+  mg_rpc_send_responsef(ri, "%.*s", response_buffer.len, response_buffer.buf);
+}
+
+static void counter_alarm_handler(struct mg_rpc_request_info *ri, void *cb_arg UNUSED_ARG,
+                                  struct mg_rpc_frame_info *fi UNUSED_ARG, struct mg_str args UNUSED_ARG)
+{
+  struct mbuf response_buffer __attribute__((__cleanup__(cleanup_mbuf)));
+  mbuf_init(&response_buffer, 256);
+  struct json_out out = JSON_OUT_MBUF(&response_buffer);
+  json_printf(&out, "{alarms:%u,", (unsigned)alarm_publish_latency.count);
+  alarm_latency_to_json(&out, "pulse_to_alarm", &alarm_pulse_latency);
+  json_printf(&out, ",");
+  alarm_latency_to_json(&out, "alarm_to_publish", &alarm_publish_latency);
+  json_printf(&out, "}");
+  mg_rpc_send_responsef(ri, "%.*s", response_buffer.len, response_buffer.buf);
+}
+
 // set new limits and store them in device config
 static void counter_set_limits_handler(struct mg_rpc_request_info *ri, void *cb_arg UNUSED_ARG,
                                        struct mg_rpc_frame_info *fi UNUSED_ARG, struct mg_str args)
@@ -535,6 +627,7 @@ static void counter_set_limits_handler(struct mg_rpc_request_info *ri, void *cb_
   if (save_cfg(&mgos_sys_config, msg))
   {
     freq_thr_hz = cfg_freq_thr_hz;
+    sensor_counter_set_alarm_threshold(freq_thr_hz);
     mg_rpc_send_responsef(ri, "{status:%B}", true);
   }
   else
@@ -544,11 +637,124 @@ static void counter_set_limits_handler(struct mg_rpc_request_info *ri, void *cb_
   free(*msg);
 }
 
+#if BENCH_MODE==1
+struct bench_response
+{
+  struct json_out out;
+  int results_count;
+};
+
+static void bench_result_to_json(const bench_result_t *result, void *user_data)
+{
+  struct bench_response *response = user_data;
+  json_printf(&response->out, "%s{name:%Q, iterations:%u, min:%u, mean:%u, max:%u}",
+              response->results_count > 0 ? "," : "",
+              result->name,
+              result->iterations,
+              result->min,
+              result->iterations > 0 ? (uint32_t)(result->total / result->iterations) : 0,
+              result->max);
+  response->results_count++;
+}
+
+static void bench_notify_listeners(void *arg UNUSED_ARG)
+{
+  notify_listeners(NOTIFY_STATUS);
+}
+
+// runs on the mgos loop and blocks it for the duration of the benchmark
+static void bench_run_handler(struct mg_rpc_request_info *ri, void *cb_arg UNUSED_ARG,
+                              struct mg_rpc_frame_info *fi UNUSED_ARG, struct mg_str args)
+{
+  char *name = NULL;
+  int iterations = 1000;
+  json_scanf(args.p, args.len, ri->args_fmt, &name, &iterations);
+  if (iterations <= 0 || iterations > 100000)
+  {
+    mg_rpc_send_errorf(ri, 500, "Bad request. Expected iterations in [1..100000]");
+    free(name);
+    return;
+  }
+
+  struct mbuf response_buffer __attribute__((__cleanup__(cleanup_mbuf)));
+  mbuf_init(&response_buffer, 1024);
+  struct bench_response response = {
+      .out = JSON_OUT_MBUF(&response_buffer),
+      .results_count = 0};
+
+  json_printf(&response.out, "{results:[");
+  bench_run(name, iterations, bench_result_to_json, &response);
+  json_printf(&response.out, "], cycles_per_us:%u, overhead:%u}", bench_cycles_per_us(), bench_overhead());
+  free(name);
+
+  mg_rpc_send_responsef(ri, "%.*s", response_buffer.len, response_buffer.buf);
+}
+
+static void bench_step_result_to_json(const bench_step_result_t *result, void *user_data)
+{
+  struct bench_response *response = user_data;
+  json_printf(&response->out, "%s{name:%Q, rate_hz:%u, output_period_ms:%u, latency_ms:%u, ramp_lag_ms:%u, step:%.2f, input_noise:%.2f, output_noise:%.3f}",
+              response->results_count > 0 ? "," : "",
+              result->name,
+              result->rate_hz,
+              result->output_period_ms,
+              result->latency_ms,
+              result->ramp_lag_ms,
+              result->step,
+              result->input_noise,
+              result->output_noise);
+  response->results_count++;
+}
+
+// runs on the mgos loop and blocks it for the duration of the simulation
+static void bench_step_handler(struct mg_rpc_request_info *ri, void *cb_arg UNUSED_ARG,
+                               struct mg_rpc_frame_info *fi UNUSED_ARG, struct mg_str args UNUSED_ARG)
+{
+  struct mbuf response_buffer __attribute__((__cleanup__(cleanup_mbuf)));
+  mbuf_init(&response_buffer, 512);
+  struct bench_response response = {
+      .out = JSON_OUT_MBUF(&response_buffer),
+      .results_count = 0};
+
+  json_printf(&response.out, "{results:[");
+  bench_step_run(bench_step_result_to_json, &response);
+  json_printf(&response.out, "]}");
+
+  mg_rpc_send_responsef(ri, "%.*s", response_buffer.len, response_buffer.buf);
+}
+#endif
+
+#if PIPELINE_STATS_MODE==1
+static void pipeline_stats_handler(struct mg_rpc_request_info *ri, void *cb_arg UNUSED_ARG,
+                                   struct mg_rpc_frame_info *fi UNUSED_ARG, struct mg_str args)
+{
+  bool reset = false;
+  json_scanf(args.p, args.len, ri->args_fmt, &reset);
+
+  struct mbuf response_buffer __attribute__((__cleanup__(cleanup_mbuf)));
+  mbuf_init(&response_buffer, 1024);
+  struct json_out out = JSON_OUT_MBUF(&response_buffer);
+  sensor_stats_to_json(&out);
+  // reset after reading so no samples are lost between two calls
+  if (reset)
+    sensor_stats_reset();
+
+  mg_rpc_send_responsef(ri, "%.*s", response_buffer.len, response_buffer.buf);
+}
+#endif
+
 enum mgos_app_init_result mgos_app_init(void)
 {
+  size_t free_heap_before_init = mgos_get_free_heap_size();
+
   // init the config values
+#if PRESSURE_MILLIVOLTS==1
+  pressure_low_value = mgos_sys_config_get_tank_mv_pressure_low_threshold();
+  pressure_high_value = mgos_sys_config_get_tank_mv_pressure_high_threshold();
+#else
   pressure_low_value = mgos_sys_config_get_tank_adc_pressure_low_threshold();
   pressure_high_value = mgos_sys_config_get_tank_adc_pressure_high_threshold();
+#endif
   liters_low_value = mgos_sys_config_get_tank_liters_low_threshold();
   liters_high_value = mgos_sys_config_get_tank_liters_high_threshold();
   freq_thr_hz = mgos_sys_config_get_tank_frequency_high_threshold();
@@ -561,12 +767,17 @@ enum mgos_app_init_result mgos_app_init(void)
   if (!sensor_pressure_init())
     return MGOS_APP_INIT_ERROR;
 
+  sensor_counter_set_alarm_threshold(freq_thr_hz);
   if (!sensor_counter_init())
     return MGOS_APP_INIT_ERROR;
 
   sensor_counter_start();
 
   tank_volume_init(pressure_low_value, pressure_high_value);
+  tank_autocal_init(pressure_low_value, pressure_high_value);
+  totalizer_running = tank_totalizer_init();
+  if (!totalizer_running)
+    LOG(LL_ERROR, ("%s, totalizer not started, the overflow volume is not reported", TAG));
 
   LOG(LL_INFO, ("Periphery started"));
 
@@ -587,18 +798,58 @@ enum mgos_app_init_result mgos_app_init(void)
   struct mg_rpc *c = mgos_rpc_get_global();
   mg_rpc_add_handler(c, "Device.Status",
                      "{}", rpc_status_handler, NULL);
+  mg_rpc_add_handler(c, "Device.Heap",
+                     "{}", heap_handler, NULL);
   mg_rpc_add_handler(c, "Pressure.SetLimits",
                      pressure_limits_fmt, pressure_set_limits_handler, NULL);
+  mg_rpc_add_handler(c, "Pressure.Autocal",
+                     "{}", pressure_autocal_handler, NULL);
+  mg_rpc_add_handler(c, "Pressure.Drift",
+                     "{}", pressure_drift_handler, NULL);
   mg_rpc_add_handler(c, "Tank.SetLimits",
                      tank_limits_fmt, tank_set_limits_handler, NULL);
+  mg_rpc_add_handler(c, "Calibration.Get",
+                     "{}", calibration_get_handler, NULL);
+  mg_rpc_add_handler(c, "Calibration.Capture",
+                     calibration_capture_fmt, calibration_capture_handler, NULL);
+  mg_rpc_add_handler(c, "Calibration.Apply",
+                     "{}", calibration_apply_handler, NULL);
+  mg_rpc_add_handler(c, "Calibration.Reset",
+                     "{}", calibration_reset_handler, NULL);
   mg_rpc_add_handler(c, "Counter.Stop",
                      "", counter_stop_handler, NULL);
   mg_rpc_add_handler(c, "Counter.Start",
                      "", counter_start_handler, NULL);
   mg_rpc_add_handler(c, "Counter.SetLimits",
                      freq_thr_fmt, counter_set_limits_handler, NULL);
+  mg_rpc_add_handler(c, "Counter.Alarm",
+                     "", counter_alarm_handler, NULL);
+  mg_rpc_add_handler(c, "Counter.Totalizer",
+                     "", counter_totalizer_handler, NULL);
+#if BENCH_MODE==1
+  bench_init();
+  // every iteration publishes to all listeners
+  bench_register("notify_listeners", bench_notify_listeners, NULL, 20);
+  mg_rpc_add_handler(c, "Bench.Run",
+                     "{name:%Q, iterations:%d}", bench_run_handler, NULL);
+  mg_rpc_add_handler(c, "Bench.Step",
+                     "{}", bench_step_handler, NULL);
+#endif
+#if PIPELINE_STATS_MODE==1
+  mg_rpc_add_handler(c, "Pipeline.Stats",
+                     "{reset:%B}", pipeline_stats_handler, NULL);
+#endif
+
+  // last, the sampling may run on the other CPU from here on
+  if (!sensor_pressure_start())
+    return MGOS_APP_INIT_ERROR;
+
+  // the sample path does not allocate after this point
+  LOG(LL_INFO, ("Heap free before init %u, after init %u, minimum %u",
+                (unsigned)free_heap_before_init, (unsigned)mgos_get_free_heap_size(), (unsigned)mgos_get_min_free_heap_size()));
 
   notify_listeners(NOTIFY_TIMER);
+  mgos_set_timer(notify_timer_tick_msec, MGOS_TIMER_REPEAT, notify_timer_callback, NULL);
 
   return MGOS_APP_INIT_SUCCESS;
 }
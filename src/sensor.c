@@ -1,8 +1,13 @@
 #include "stdlib.h"
 #include "stdio.h"
 #include "assert.h"
+#include "string.h"
+#include "math.h"
 
 #include "mgos.h"
+#if PIPELINE_STATS_MODE==1
+#include "frozen.h"
+#endif
 
 #include "sensor.h"
 
@@ -35,7 +40,7 @@ void remove_filter(observable_value_t *ov, filter_item_t *fi)
   {
     if ((*current_filter)->next == fi)
     {
-      (*current_filter)->next = (*current_filter)->next;
+      (*current_filter)->next = fi->next;
       return;
     }
 
@@ -45,192 +50,870 @@ void remove_filter(observable_value_t *ov, filter_item_t *fi)
 
 filter_ret_val_t filter_item_clamp_fn(filter_item_t *this, observable_number_t *var)
 {
-  filter_item_clamp_t *fi = (filter_item_clamp_t *)this;
-  if (var->value < fi->min)
-    var->value = fi->min;
-  if (var->value > fi->max)
-    var->value = fi->max;
-  return FILTER_CONTINUE;
+  return filter_item_clamp_apply((filter_item_clamp_t *)this, var);
 }
 
 filter_ret_val_t filter_item_offset_fn(filter_item_t *this, observable_number_t *var)
 {
-  filter_item_offset_t *fi = (filter_item_offset_t *)this;
-  var->value += fi->offset;
-  return FILTER_CONTINUE;
+  return filter_item_offset_apply((filter_item_offset_t *)this, var);
 }
 
 filter_ret_val_t filter_item_skip_fn(filter_item_t *this, observable_number_t *var)
 {
-  filter_item_skip_t *fi = (filter_item_skip_t *)this;
-  if (fi->skip > 0)
+  return filter_item_skip_apply((filter_item_skip_t *)this, var);
+}
+
+filter_ret_val_t filter_item_exp_moving_average_fn(filter_item_t *this, observable_number_t *var)
+{
+  return filter_item_exp_moving_average_apply((filter_item_exp_moving_average_t *)this, var);
+}
+
+filter_ret_val_t filter_item_average_fn(filter_item_t *this, observable_number_t *var)
+{
+  return filter_item_average_apply((filter_item_average_t *)this, var);
+}
+
+filter_ret_val_t filter_item_harmonic_average_fn(filter_item_t *this, observable_number_t *var)
+{
+  return filter_item_harmonic_average_apply((filter_item_harmonic_average_t *)this, var);
+}
+
+bool filter_linear_fit_calc(filter_item_linear_fit_t *this)
+{
+  if(this->value_map[0][0] == this->value_map[1][0]) {
+    return false;
+  }
+  this->slope_ = (this->value_map[0][1] - this->value_map[1][1]) / (this->value_map[0][0] - this->value_map[1][0]);
+  this->intercept_ = this->value_map[0][1] - this->slope_ * this->value_map[0][0];
+  return true;
+}
+
+filter_ret_val_t filter_item_linear_fit_fn(filter_item_t *this, observable_number_t *var)
+{
+  return filter_item_linear_fit_apply((filter_item_linear_fit_t *)this, var);
+}
+
+// out = fit_out(clamp(fit_in(x))) as one clamp(slope * x + intercept)
+// the second fit is monotonic, so the clamp moves after it with mapped bounds
+bool filter_affine_clamp_fuse(filter_item_affine_clamp_t *this,
+                              const filter_item_linear_fit_t *fit_in,
+                              const filter_item_clamp_t *clamp,
+                              const filter_item_linear_fit_t *fit_out)
+{
+  if (fit_in->value_map[0][0] == fit_in->value_map[1][0] || fit_out->value_map[0][0] == fit_out->value_map[1][0])
+    return false;
+  number_type bound_low = (number_type)fit_out->slope_ * clamp->min + fit_out->intercept_;
+  number_type bound_high = (number_type)fit_out->slope_ * clamp->max + fit_out->intercept_;
+  this->slope = (number_type)fit_out->slope_ * fit_in->slope_;
+  this->intercept = (number_type)fit_out->slope_ * fit_in->intercept_ + fit_out->intercept_;
+  this->min = bound_low < bound_high ? bound_low : bound_high;
+  this->max = bound_low < bound_high ? bound_high : bound_low;
+  return true;
+}
+
+filter_ret_val_t filter_item_affine_clamp_fn(filter_item_t *this, observable_number_t *var)
+{
+  return filter_item_affine_clamp_apply((filter_item_affine_clamp_t *)this, var);
+}
+
+bool filter_calibration_calc(filter_item_calibration_t *this)
+{
+  if (this->points_count < 2 || this->points_count > SENSOR_CALIBRATION_MAX_POINTS)
+    return false;
+  uint8_t last = this->points_count - 1;
+  for (uint8_t i = 0; i < last; i++)
   {
-    fi->skip--;
-    return FILTER_STOP;
+    if (this->x[i + 1] <= this->x[i])
+      return false;
+    this->slopes_[i] = (this->y[i + 1] - this->y[i]) / (this->x[i + 1] - this->x[i]);
+  }
+  this->slopes_[last] = this->slopes_[last - 1];
+
+  // Fritsch-Carlson, the tangent is the mean of the neighbouring slopes,
+  // 0 at a local extremum, limited so no interval overshoots
+  this->tangents_[0] = this->slopes_[0];
+  this->tangents_[last] = this->slopes_[last - 1];
+  for (uint8_t i = 1; i < last; i++)
+  {
+    if (this->slopes_[i - 1] * this->slopes_[i] <= 0)
+      this->tangents_[i] = 0;
+    else
+      this->tangents_[i] = (this->slopes_[i - 1] + this->slopes_[i]) / 2;
+  }
+  for (uint8_t i = 0; i < last; i++)
+  {
+    if (this->slopes_[i] == 0)
+    {
+      this->tangents_[i] = 0;
+      this->tangents_[i + 1] = 0;
+      continue;
+    }
+    float a = this->tangents_[i] / this->slopes_[i];
+    float b = this->tangents_[i + 1] / this->slopes_[i];
+    float r = a * a + b * b;
+    if (r > 9)
+    {
+      float tau = 3 / sqrtf(r);
+      this->tangents_[i] = tau * a * this->slopes_[i];
+      this->tangents_[i + 1] = tau * b * this->slopes_[i];
+    }
+  }
+  return true;
+}
+
+filter_ret_val_t filter_item_calibration_fn(filter_item_t *this, observable_number_t *var)
+{
+  return filter_item_calibration_apply((filter_item_calibration_t *)this, var);
+}
+
+// running median, two heaps around the median in one array
+// see the layout in sensor.h, minimum heap at 1..size/2, maximum heap at -1..-size/2
+#define RM_HEAP(rm, i) ((rm)->heap_[(i) + (rm)->size / 2])
+#define RM_MIN_COUNT(rm) (((rm)->count_ - 1) / 2)
+#define RM_MAX_COUNT(rm) ((rm)->count_ / 2)
+
+static bool rm_less(const sensor_running_median_t *rm, int i, int j)
+{
+  return rm->data_[RM_HEAP(rm, i)] < rm->data_[RM_HEAP(rm, j)];
+}
+
+static bool rm_exchange(sensor_running_median_t *rm, int i, int j)
+{
+  int8_t t = RM_HEAP(rm, i);
+  RM_HEAP(rm, i) = RM_HEAP(rm, j);
+  RM_HEAP(rm, j) = t;
+  rm->pos_[RM_HEAP(rm, i)] = i;
+  rm->pos_[RM_HEAP(rm, j)] = j;
+  return true;
+}
+
+// swap when heap item i is less than heap item j
+static bool rm_cmp_exchange(sensor_running_median_t *rm, int i, int j)
+{
+  return rm_less(rm, i, j) && rm_exchange(rm, i, j);
+}
+
+// i is the first child to check, 1 is the only child of the median
+static void rm_min_sort_down(sensor_running_median_t *rm, int i)
+{
+  for (; i <= RM_MIN_COUNT(rm); i *= 2)
+  {
+    if (i > 1 && i < RM_MIN_COUNT(rm) && rm_less(rm, i + 1, i))
+      i++;
+    if (!rm_cmp_exchange(rm, i, i / 2))
+      break;
+  }
+}
+
+static void rm_max_sort_down(sensor_running_median_t *rm, int i)
+{
+  for (; i >= -RM_MAX_COUNT(rm); i *= 2)
+  {
+    if (i < -1 && i > -RM_MAX_COUNT(rm) && rm_less(rm, i, i - 1))
+      i--;
+    if (!rm_cmp_exchange(rm, i / 2, i))
+      break;
+  }
+}
+
+// returns true when the item got to the median
+static bool rm_min_sort_up(sensor_running_median_t *rm, int i)
+{
+  while (i > 0 && rm_cmp_exchange(rm, i, i / 2))
+    i /= 2;
+  return i == 0;
+}
+
+static bool rm_max_sort_up(sensor_running_median_t *rm, int i)
+{
+  while (i < 0 && rm_cmp_exchange(rm, i / 2, i))
+    i /= 2;
+  return i == 0;
+}
+
+void running_median_init(sensor_running_median_t *rm, uint8_t size)
+{
+  assert(size > 0 && size <= SENSOR_WINDOW_MAX_SIZE);
+  rm->size = size;
+  rm->index_ = 0;
+  rm->count_ = 0;
+  // fill pattern median, max, min, max, min...
+  for (int i = size - 1; i >= 0; i--)
+  {
+    rm->data_[i] = 0;
+    rm->pos_[i] = ((i + 1) / 2) * ((i & 1) ? -1 : 1);
+    RM_HEAP(rm, rm->pos_[i]) = i;
+  }
+}
+
+void running_median_insert(sensor_running_median_t *rm, number_type value)
+{
+  bool is_new = rm->count_ < rm->size;
+  int p = rm->pos_[rm->index_];
+  number_type old = rm->data_[rm->index_];
+  rm->data_[rm->index_] = value;
+  if (++rm->index_ == rm->size)
+    rm->index_ = 0;
+  if (is_new)
+    rm->count_++;
+
+  if (p > 0)
+  {
+    // in the minimum heap
+    if (!is_new && old < value)
+      rm_min_sort_down(rm, p * 2);
+    else if (rm_min_sort_up(rm, p))
+      rm_max_sort_down(rm, -1);
+  }
+  else if (p < 0)
+  {
+    // in the maximum heap
+    if (!is_new && value < old)
+      rm_max_sort_down(rm, p * 2);
+    else if (rm_max_sort_up(rm, p))
+      rm_min_sort_down(rm, 1);
+  }
+  else
+  {
+    // replaced the median itself
+    if (RM_MAX_COUNT(rm) > 0)
+      rm_max_sort_down(rm, -1);
+    if (RM_MIN_COUNT(rm) > 0)
+      rm_min_sort_down(rm, 1);
+  }
+}
+
+// mean of the two middle samples for an even count
+number_type running_median_get(const sensor_running_median_t *rm)
+{
+  number_type value = rm->data_[RM_HEAP(rm, 0)];
+  if (rm->count_ > 0 && (rm->count_ & 1) == 0)
+    value = (value + rm->data_[RM_HEAP(rm, -1)]) / 2;
+  return value;
+}
+
+// median of a scratch array by selection, reorders values
+static number_type window_median(number_type *values, size_t n)
+{
+  size_t k = n / 2;
+  size_t left = 0;
+  size_t right = n - 1;
+  while (left < right)
+  {
+    number_type pivot = values[(left + right) / 2];
+    size_t i = left;
+    size_t j = right;
+    while (i <= j)
+    {
+      while (values[i] < pivot)
+        i++;
+      while (pivot < values[j])
+        j--;
+      if (i <= j)
+      {
+        number_type t = values[i];
+        values[i] = values[j];
+        values[j] = t;
+        i++;
+        if (j == 0)
+          break;
+        j--;
+      }
+    }
+    if (k <= j)
+      right = j;
+    else if (k >= i)
+      left = i;
+    else
+      break;
+  }
+  number_type median = values[k];
+  if ((n & 1) == 0)
+  {
+    // lower middle is the largest value left of k
+    number_type lower = values[0];
+    for (size_t i = 1; i < k; i++)
+    {
+      if (values[i] > lower)
+        lower = values[i];
+    }
+    median = (median + lower) / 2;
+  }
+  return median;
+}
+
+void window_regression_init(sensor_window_regression_t *wr, uint8_t size)
+{
+  assert(size > 1 && size <= SENSOR_WINDOW_MAX_SIZE);
+  memset(wr, 0, sizeof(*wr));
+  wr->size = size;
+}
+
+void window_regression_add(sensor_window_regression_t *wr, double x, number_type y)
+{
+  if (wr->count_ == 0)
+    wr->x0_ = x;
+  if (wr->count_ < wr->size)
+  {
+    wr->count_++;
+  }
+  else
+  {
+    double old_x = wr->x_[wr->index_] - wr->x0_;
+    number_type old_y = wr->y_[wr->index_];
+    wr->sum_x_ -= old_x;
+    wr->sum_y_ -= old_y;
+    wr->sum_xx_ -= old_x * old_x;
+    wr->sum_xy_ -= old_x * old_y;
+  }
+  wr->x_[wr->index_] = x;
+  wr->y_[wr->index_] = y;
+  double dx = x - wr->x0_;
+  wr->sum_x_ += dx;
+  wr->sum_y_ += y;
+  wr->sum_xx_ += dx * dx;
+  wr->sum_xy_ += dx * y;
+  if (++wr->index_ == wr->size)
+  {
+    wr->index_ = 0;
+    wr->x0_ = x;
+    wr->sum_x_ = wr->sum_y_ = wr->sum_xx_ = wr->sum_xy_ = 0;
+    for (uint8_t i = 0; i < wr->count_; i++)
+    {
+      dx = wr->x_[i] - wr->x0_;
+      wr->sum_x_ += dx;
+      wr->sum_y_ += wr->y_[i];
+      wr->sum_xx_ += dx * dx;
+      wr->sum_xy_ += dx * wr->y_[i];
+    }
+  }
+}
+
+bool window_regression_slope(const sensor_window_regression_t *wr, number_type *slope)
+{
+  double n = wr->count_;
+  double denominator = n * wr->sum_xx_ - wr->sum_x_ * wr->sum_x_;
+  if (wr->count_ < 2 || denominator <= 0)
+    return false;
+  *slope = (n * wr->sum_xy_ - wr->sum_x_ * wr->sum_y_) / denominator;
+  return true;
+}
+
+void sensor_rls_init(sensor_rls_t *rls, uint8_t k, float lambda, float delta, const float *theta)
+{
+  assert(k > 0 && k <= SENSOR_RLS_MAX_K);
+  memset(rls, 0, sizeof(*rls));
+  rls->k = k;
+  rls->lambda = lambda;
+  for (uint8_t i = 0; i < k; i++)
+  {
+    rls->theta[i] = theta != NULL ? theta[i] : 0;
+    rls->p[i][i] = delta;
   }
+}
+
+float sensor_rls_predict(const sensor_rls_t *rls, const float *x)
+{
+  float y = 0;
+  for (uint8_t i = 0; i < rls->k; i++)
+    y += rls->theta[i] * x[i];
+  return y;
+}
+
+float sensor_rls_update(sensor_rls_t *rls, const float *x, float y)
+{
+  uint8_t k = rls->k;
+  float px[SENSOR_RLS_MAX_K];
+  float denominator = rls->lambda;
+  for (uint8_t i = 0; i < k; i++)
+  {
+    px[i] = 0;
+    for (uint8_t j = 0; j < k; j++)
+      px[i] += rls->p[i][j] * x[j];
+    denominator += x[i] * px[i];
+  }
+  float error = y - sensor_rls_predict(rls, x);
+  // gain px / denominator, p = (p - gain px') / lambda kept symmetric
+  for (uint8_t i = 0; i < k; i++)
+    rls->theta[i] += px[i] / denominator * error;
+  for (uint8_t i = 0; i < k; i++)
+  {
+    for (uint8_t j = i; j < k; j++)
+    {
+      float value = (rls->p[i][j] - px[i] * px[j] / denominator) / rls->lambda;
+      rls->p[i][j] = value;
+      rls->p[j][i] = value;
+    }
+  }
+  rls->updates++;
+  return error;
+}
+
+filter_ret_val_t filter_item_moving_median_apply(filter_item_moving_median_t *fi, observable_number_t *var)
+{
+  if (fi->initialized == false)
+  {
+    running_median_init(&fi->median_, fi->window_size);
+    fi->initialized = true;
+  }
+  running_median_insert(&fi->median_, var->value);
+  var->value = running_median_get(&fi->median_);
   return FILTER_CONTINUE;
 }
 
-filter_ret_val_t filter_item_exp_moving_average_fn(filter_item_t *this, observable_number_t *var)
+filter_ret_val_t filter_item_hampel_apply(filter_item_hampel_t *fi, observable_number_t *var)
+{
+  sensor_running_median_t *rm = &fi->median_;
+  if (fi->initialized == false)
+  {
+    running_median_init(rm, fi->window_size);
+    fi->initialized = true;
+  }
+  running_median_insert(rm, var->value);
+  number_type median = running_median_get(rm);
+  number_type deviation = fabs(var->value - median);
+  // most samples are within min_deviation, no need for the MAD then
+  if (deviation <= fi->min_deviation)
+    return FILTER_CONTINUE;
+
+  number_type deviations[SENSOR_WINDOW_MAX_SIZE];
+  for (uint8_t i = 0; i < rm->count_; i++)
+    deviations[i] = fabs(rm->data_[i] - median);
+  // 1.4826 scales the MAD to the standard deviation of normal noise
+  number_type limit = fi->threshold * 1.4826 * window_median(deviations, rm->count_);
+  if (deviation <= limit)
+    return FILTER_CONTINUE;
+
+  fi->outliers++;
+  if (fi->replace == false)
+    return FILTER_STOP;
+  var->value = median;
+  return FILTER_CONTINUE;
+}
+
+void filter_cic_reset(filter_item_cic_t *this)
+{
+  assert(this->order > 0 && this->order <= SENSOR_CIC_MAX_ORDER && this->decimation > 0);
+  this->gain_ = 1;
+  for (uint8_t i = 0; i < this->order; i++)
+  {
+    this->gain_ *= this->decimation;
+    this->integrators_[i] = 0;
+    this->combs_[i] = 0;
+  }
+  this->sample_counter_ = this->decimation;
+  this->warmup_ = this->order - 1;
+  this->initialized = true;
+}
+
+filter_ret_val_t filter_item_cic_fn(filter_item_t *this, observable_number_t *var)
+{
+  return filter_item_cic_apply((filter_item_cic_t *)this, var);
+}
+
+filter_ret_val_t filter_item_sliding_mean_fn(filter_item_t *this, observable_number_t *var)
+{
+  return filter_item_sliding_mean_apply((filter_item_sliding_mean_t *)this, var);
+}
+
+filter_ret_val_t filter_item_moving_median_fn(filter_item_t *this, observable_number_t *var)
+{
+  return filter_item_moving_median_apply((filter_item_moving_median_t *)this, var);
+}
+
+filter_ret_val_t filter_item_hampel_fn(filter_item_t *this, observable_number_t *var)
+{
+  return filter_item_hampel_apply((filter_item_hampel_t *)this, var);
+}
+
+// block filters
+// same state transitions as the single sample versions,
+// surviving samples are compacted to the front of the block
+size_t filter_item_clamp_block_fn(filter_item_t *this, number_type *values, size_t n)
+{
+  filter_item_clamp_t *fi = (filter_item_clamp_t *)this;
+  for (size_t i = 0; i < n; i++)
+  {
+    if (values[i] < fi->min)
+      values[i] = fi->min;
+    if (values[i] > fi->max)
+      values[i] = fi->max;
+  }
+  return n;
+}
+
+size_t filter_item_offset_block_fn(filter_item_t *this, number_type *values, size_t n)
+{
+  filter_item_offset_t *fi = (filter_item_offset_t *)this;
+  for (size_t i = 0; i < n; i++)
+    values[i] += fi->offset;
+  return n;
+}
+
+size_t filter_item_skip_block_fn(filter_item_t *this, number_type *values, size_t n)
+{
+  filter_item_skip_t *fi = (filter_item_skip_t *)this;
+  size_t skipped = fi->skip < n ? fi->skip : n;
+  if (skipped == 0)
+    return n;
+  fi->skip -= skipped;
+  memmove(values, values + skipped, (n - skipped) * sizeof(number_type));
+  return n - skipped;
+}
+
+size_t filter_item_exp_moving_average_block_fn(filter_item_t *this, number_type *values, size_t n)
 {
   filter_item_exp_moving_average_t *fi = (filter_item_exp_moving_average_t *)this;
+  size_t i = 0;
+  if (n == 0)
+    return 0;
   if (fi->initialized == false)
   {
-    fi->previous_value = var->value;
+    fi->previous_value = values[0];
     fi->initialized = true;
   }
   if (fi->pass_first)
   {
     fi->pass_first = false;
-    return FILTER_CONTINUE;
+    i = 1;
   }
-  var->value = fi->previous_value + fi->alpha * (var->value - fi->previous_value);
-  fi->previous_value = var->value;
-
-  return FILTER_CONTINUE;
+  number_type previous_value = fi->previous_value;
+  for (; i < n; i++)
+  {
+    previous_value = previous_value + fi->alpha * (values[i] - previous_value);
+    values[i] = previous_value;
+  }
+  fi->previous_value = previous_value;
+  return n;
 }
 
-filter_ret_val_t filter_item_average_fn(filter_item_t *this, observable_number_t *var)
+size_t filter_item_average_block_fn(filter_item_t *this, number_type *values, size_t n)
 {
   filter_item_average_t *fi = (filter_item_average_t *)this;
   assert(fi->number_of_samples > 0);
-  fi->accumulator_ += var->value;
-  fi->sample_counter_--;
-  if (fi->sample_counter_ > 0)
-    return FILTER_STOP;
-
-  var->value = fi->accumulator_ / fi->number_of_samples;
-  fi->accumulator_ = 0;
-  fi->sample_counter_ = fi->number_of_samples;
-
-  return FILTER_CONTINUE;
+  size_t out = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    fi->accumulator_ += values[i];
+    if (--fi->sample_counter_ > 0)
+      continue;
+    values[out++] = fi->accumulator_ / fi->number_of_samples;
+    fi->accumulator_ = 0;
+    fi->sample_counter_ = fi->number_of_samples;
+  }
+  return out;
 }
 
-filter_ret_val_t filter_item_harmonic_average_fn(filter_item_t *this, observable_number_t *var)
+size_t filter_item_harmonic_average_block_fn(filter_item_t *this, number_type *values, size_t n)
 {
   filter_item_harmonic_average_t *fi = (filter_item_harmonic_average_t *)this;
   assert(fi->number_of_samples > 0);
-  fi->accumulator_ += 1/var->value;
-  fi->sample_counter_--;
-  if (fi->sample_counter_ > 0)
-    return FILTER_STOP;
-
-  var->value = fi->number_of_samples / fi->accumulator_;
-  fi->accumulator_ = 0;
-  fi->sample_counter_ = fi->number_of_samples;
-
-  return FILTER_CONTINUE;
+  size_t out = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    fi->accumulator_ += 1 / values[i];
+    if (--fi->sample_counter_ > 0)
+      continue;
+    values[out++] = fi->number_of_samples / fi->accumulator_;
+    fi->accumulator_ = 0;
+    fi->sample_counter_ = fi->number_of_samples;
+  }
+  return out;
 }
 
-bool filter_linear_fit_calc(filter_item_linear_fit_t *this)
+size_t filter_item_affine_clamp_block_fn(filter_item_t *this, number_type *values, size_t n)
 {
-  if(this->value_map[0][0] == this->value_map[1][0]) {
-    return false;
+  filter_item_affine_clamp_t *fi = (filter_item_affine_clamp_t *)this;
+  for (size_t i = 0; i < n; i++)
+  {
+    number_type value = fi->slope * values[i] + fi->intercept;
+    if (value < fi->min)
+      value = fi->min;
+    if (value > fi->max)
+      value = fi->max;
+    values[i] = value;
   }
-  this->slope_ = (this->value_map[0][1] - this->value_map[1][1]) / (this->value_map[0][0] - this->value_map[1][0]);
-  this->intercept_ = this->value_map[0][1] - this->slope_ * this->value_map[0][0];
-  return true;
+  return n;
 }
 
-filter_ret_val_t filter_item_linear_fit_fn(filter_item_t *this, observable_number_t *var)
+size_t filter_item_linear_fit_block_fn(filter_item_t *this, number_type *values, size_t n)
 {
   filter_item_linear_fit_t *fi = (filter_item_linear_fit_t *)this;
   assert(fi->value_map[0][0] != fi->value_map[1][0]);
-  // y1-y2/x1-x2
-  // float slope = (fi->value_map[0][1] - fi->value_map[1][1]) / (fi->value_map[0][0] - fi->value_map[1][0]);
-  // y1 - slope*x1
-  // float intercept = fi->value_map[0][1] - slope * fi->value_map[0][0];
-  var->value = fi->slope_ * var->value + fi->intercept_;
-  return FILTER_CONTINUE;
+  for (size_t i = 0; i < n; i++)
+    values[i] = fi->slope_ * values[i] + fi->intercept_;
+  return n;
 }
 
-// observer methods
-// same callback is allowed multiple times
-void add_observer(observable_value_t *ov, value_observer_cb observer_cb)
+size_t filter_item_cic_block_fn(filter_item_t *this, number_type *values, size_t n)
 {
-  value_observer_item_t **current_observer = &ov->observers;
+  filter_item_cic_t *fi = (filter_item_cic_t *)this;
+  size_t out = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    observable_number_t value_ = {
+        .value = values[i]};
+    if (filter_item_cic_apply(fi, &value_) == FILTER_CONTINUE)
+      values[out++] = value_.value;
+  }
+  return out;
+}
 
-  value_observer_item_t *new_observer_item = (value_observer_item_t *)malloc(sizeof(value_observer_item_t));
-  if (new_observer_item == NULL)
-    return;
-  new_observer_item->observer = observer_cb;
-  new_observer_item->next = NULL;
+size_t filter_item_sliding_mean_block_fn(filter_item_t *this, number_type *values, size_t n)
+{
+  filter_item_sliding_mean_t *fi = (filter_item_sliding_mean_t *)this;
+  for (size_t i = 0; i < n; i++)
+  {
+    observable_number_t value_ = {
+        .value = values[i]};
+    filter_item_sliding_mean_apply(fi, &value_);
+    values[i] = value_.value;
+  }
+  return n;
+}
 
-  if ((*current_observer) == NULL)
+size_t filter_item_moving_median_block_fn(filter_item_t *this, number_type *values, size_t n)
+{
+  filter_item_moving_median_t *fi = (filter_item_moving_median_t *)this;
+  for (size_t i = 0; i < n; i++)
   {
-    *current_observer = new_observer_item;
-    return;
+    observable_number_t value_ = {
+        .value = values[i]};
+    filter_item_moving_median_apply(fi, &value_);
+    values[i] = value_.value;
   }
+  return n;
+}
 
-  while ((*current_observer)->next != NULL)
+size_t filter_item_calibration_block_fn(filter_item_t *this, number_type *values, size_t n)
+{
+  filter_item_calibration_t *fi = (filter_item_calibration_t *)this;
+  for (size_t i = 0; i < n; i++)
   {
-    current_observer = &(*current_observer)->next;
+    observable_number_t value_ = {
+        .value = values[i]};
+    filter_item_calibration_apply(fi, &value_);
+    values[i] = value_.value;
   }
-  (*current_observer)->next = new_observer_item;
+  return n;
 }
 
-void remove_observer(observable_value_t *ov, value_observer_cb observer_cb)
+filter_ret_val_t filter_item_kalman_level_apply(filter_item_kalman_level_t *fi, observable_number_t *var)
 {
-  value_observer_item_t **current_observer = &ov->observers;
+  if (fi->initialized == false)
+  {
+    fi->level_ = var->value;
+    fi->rate_ = 0;
+    fi->p_[0][0] = fi->measurement_noise;
+    fi->p_[0][1] = fi->p_[1][0] = 0;
+    // a rate variance, the random walk of the rate over one sample
+    fi->p_[1][1] = fi->process_noise * fi->dt;
+    fi->sample_counter_ = fi->output_every;
+    fi->initialized = true;
+  }
+  else
+  {
+    // predict, x = F x, P = F P F' + Q with F = [1 dt; 0 1]
+    float dt = fi->dt;
+    float q = fi->process_noise;
+    fi->level_ += fi->rate_ * dt;
+    float p00 = fi->p_[0][0] + dt * (fi->p_[0][1] + fi->p_[1][0] + dt * fi->p_[1][1]) + q * dt * dt * dt / 3;
+    float p01 = fi->p_[0][1] + dt * fi->p_[1][1] + q * dt * dt / 2;
+    float p11 = fi->p_[1][1] + q * dt;
 
-  if ((*current_observer) == NULL)
-    return;
+    // update with the level measurement
+    float r = fi->overflow ? fi->measurement_noise * fi->overflow_noise_scale : fi->measurement_noise;
+    float s = p00 + r;
+    float k0 = p00 / s;
+    float k1 = p01 / s;
+    number_type innovation = var->value - fi->level_;
+    fi->level_ += k0 * innovation;
+    fi->rate_ += k1 * innovation;
+    fi->p_[0][0] = p00 - k0 * p00;
+    fi->p_[0][1] = fi->p_[1][0] = p01 - k0 * p01;
+    fi->p_[1][1] = p11 - k1 * p01;
+    // the overflow pipe holds the level, the deweighted reading only
+    // corrects it slowly and the rate is dropped
+    if (fi->overflow)
+    {
+      fi->rate_ = 0;
+      fi->p_[0][1] = fi->p_[1][0] = 0;
+    }
+  }
+
+  if (--fi->sample_counter_ > 0)
+    return FILTER_STOP;
+  fi->sample_counter_ = fi->output_every;
+  var->value = fi->level_;
+  return FILTER_CONTINUE;
+}
+
+filter_ret_val_t filter_item_kalman_level_fn(filter_item_t *this, observable_number_t *var)
+{
+  return filter_item_kalman_level_apply((filter_item_kalman_level_t *)this, var);
+}
 
-  if ((*current_observer)->observer == observer_cb)
+size_t filter_item_kalman_level_block_fn(filter_item_t *this, number_type *values, size_t n)
+{
+  filter_item_kalman_level_t *fi = (filter_item_kalman_level_t *)this;
+  size_t out = 0;
+  for (size_t i = 0; i < n; i++)
   {
-    value_observer_item_t *rm = (*current_observer);
-    *current_observer = (*current_observer)->next;
-    free(rm);
-    return;
+    observable_number_t value_ = {
+        .value = values[i]};
+    if (filter_item_kalman_level_apply(fi, &value_) == FILTER_CONTINUE)
+      values[out++] = value_.value;
   }
+  return out;
+}
 
-  while ((*current_observer)->next != NULL)
+size_t filter_item_hampel_block_fn(filter_item_t *this, number_type *values, size_t n)
+{
+  filter_item_hampel_t *fi = (filter_item_hampel_t *)this;
+  size_t out = 0;
+  for (size_t i = 0; i < n; i++)
   {
-    if ((*current_observer)->next->observer == observer_cb)
-    {
-      value_observer_item_t *rm = (*current_observer)->next;
-      (*current_observer)->next = (*current_observer)->next->next;
-      free(rm);
-      return;
-    }
-    current_observer = &(*current_observer)->next;
+    observable_number_t value_ = {
+        .value = values[i]};
+    if (filter_item_hampel_apply(fi, &value_) == FILTER_CONTINUE)
+      values[out++] = value_.value;
   }
+  return out;
 }
 
-void cleanup_observers(observable_value_t *ov)
+// run a filter without a block version sample by sample
+static size_t filter_block_fallback(filter_item_t *fi, number_type *values, size_t n)
+{
+  size_t out = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    observable_number_t value_ = {
+        .value = values[i]};
+    if (fi->filter(fi, &value_) == FILTER_CONTINUE)
+      values[out++] = value_.value;
+  }
+  return out;
+}
+
+// static chains are inlined per sample, the block loop is around the whole chain
+static size_t filter_chain_block(const filter_chain_t *chain, number_type *values, size_t n)
 {
-  value_observer_item_t *current_observer = ov->observers;
-  value_observer_item_t *next_observer;
+  size_t out = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    observable_number_t value_ = {
+        .value = values[i]};
+    if (chain->run(&value_) == FILTER_CONTINUE)
+      values[out++] = value_.value;
+  }
+  return out;
+}
 
-  if (current_observer == NULL)
+#if PIPELINE_STATS_MODE==1
+static observable_value_t *stats_observables[SENSOR_STATS_MAX_OBSERVABLES];
+static size_t stats_observables_count = 0;
+
+static void stats_observed(observable_value_t *ov, uint32_t calls)
+{
+  if (ov->stats.registered == false && stats_observables_count < SENSOR_STATS_MAX_OBSERVABLES)
+  {
+    stats_observables[stats_observables_count++] = ov;
+    ov->stats.registered = true;
+  }
+  ov->stats.calls += calls;
+}
+
+static void stats_accepted(observable_value_t *ov)
+{
+  ov->stats.accepted++;
+  ov->stats.last_value = ov->value.value;
+}
+
+#define SENSOR_STATS_OBSERVED(ov, calls) stats_observed(ov, calls)
+#define SENSOR_STATS_ACCEPTED(ov) stats_accepted(ov)
+#else
+#define SENSOR_STATS_OBSERVED(ov, calls)
+#define SENSOR_STATS_ACCEPTED(ov)
+#endif
+
+// observer methods
+// same callback is allowed multiple times
+int add_observer(observable_value_t *ov, value_observer_cb observer_cb)
+{
+  int slot;
+  for (slot = 0; slot < ov->observers_count; slot++)
+  {
+    if (ov->observers[slot].observer == NULL)
+      break;
+  }
+  if (slot == SENSOR_MAX_OBSERVERS)
+  {
+    LOG(LL_ERROR, ("%s, observer table full", ov->name));
+    return -1;
+  }
+  ov->observers[slot].observer = observer_cb;
+  if (slot == ov->observers_count)
+    ov->observers_count++;
+  return slot;
+}
+
+void remove_observer_slot(observable_value_t *ov, int slot)
+{
+  if (slot < 0 || slot >= ov->observers_count)
     return;
+  ov->observers[slot].observer = NULL;
+  // drop empty slots at the end so notify does not walk them
+  while (ov->observers_count > 0 && ov->observers[ov->observers_count - 1].observer == NULL)
+    ov->observers_count--;
+}
 
-  while (current_observer != NULL)
+void remove_observer(observable_value_t *ov, value_observer_cb observer_cb)
+{
+  for (int slot = 0; slot < ov->observers_count; slot++)
   {
-    next_observer = current_observer->next;
-    free(current_observer);
-    current_observer = next_observer;
+    if (ov->observers[slot].observer == observer_cb)
+    {
+      remove_observer_slot(ov, slot);
+      return;
+    }
   }
 }
 
+void cleanup_observers(observable_value_t *ov)
+{
+  for (int slot = 0; slot < ov->observers_count; slot++)
+    ov->observers[slot].observer = NULL;
+  ov->observers_count = 0;
+}
+
 void notify_observers(observable_value_t *ov)
 {
-  value_observer_item_t *current_observer = ov->observers;
-  while (current_observer != NULL)
+  for (int slot = 0; slot < ov->observers_count; slot++)
   {
-    current_observer->observer(ov);
-    current_observer = current_observer->next;
+    if (ov->observers[slot].observer != NULL)
+    {
+      SENSOR_STATS_BEGIN(observer_start);
+      ov->observers[slot].observer(ov);
+      SENSOR_STATS_CYCLES(ov->observers[slot].stats, observer_start);
+    }
   }
 }
 
 // value methods
 void set_value(observable_value_t *ov, observable_number_t new_value)
 {
+  SENSOR_STATS_OBSERVED(ov, 1);
+  if (ov->chain != NULL && ov->chain->run(&new_value) != FILTER_CONTINUE)
+    return;
+
   filter_item_t *current_filter = ov->filters;
   bool accept_new_value = true;
   while (current_filter != NULL)
   {
-    if (current_filter->filter(current_filter, &new_value) != FILTER_CONTINUE)
+    SENSOR_STATS_BEGIN(filter_start);
+    filter_ret_val_t ret_val = current_filter->filter(current_filter, &new_value);
+    SENSOR_STATS_FILTER(current_filter, filter_start, ret_val == FILTER_CONTINUE, ret_val != FILTER_CONTINUE);
+    if (ret_val != FILTER_CONTINUE)
     {
       accept_new_value = false;
       break;
@@ -240,13 +923,149 @@ void set_value(observable_value_t *ov, observable_number_t new_value)
   if (accept_new_value == true)
   {
     ov->value = new_value;
+    SENSOR_STATS_ACCEPTED(ov);
+    ov->notify(ov);
+  }
+}
+
+// new_values is used as scratch space by the filters
+void set_values(observable_value_t *ov, number_type *new_values, size_t n)
+{
+  SENSOR_STATS_OBSERVED(ov, n);
+  if (ov->chain != NULL)
+    n = filter_chain_block(ov->chain, new_values, n);
+
+  filter_item_t *current_filter = ov->filters;
+  while (current_filter != NULL && n > 0)
+  {
+    // a block counts as one timing sample
+    SENSOR_STATS_BEGIN(filter_start);
+    size_t n_in = n;
+    if (current_filter->block_filter != NULL)
+      n = current_filter->block_filter(current_filter, new_values, n);
+    else
+      n = filter_block_fallback(current_filter, new_values, n);
+    SENSOR_STATS_FILTER(current_filter, filter_start, n, n_in - n);
+    (void)n_in;
+    current_filter = current_filter->next;
+  }
+  for (size_t i = 0; i < n; i++)
+  {
+    ov->value.value = new_values[i];
+    SENSOR_STATS_ACCEPTED(ov);
     ov->notify(ov);
   }
 }
 
+void process_new_values(observable_value_t *ov, const number_type *samples, size_t n)
+{
+  number_type block[SENSOR_BLOCK_SIZE];
+  while (n > 0)
+  {
+    size_t block_n = n < SENSOR_BLOCK_SIZE ? n : SENSOR_BLOCK_SIZE;
+    memcpy(block, samples, block_n * sizeof(number_type));
+    set_values(ov, block, block_n);
+    samples += block_n;
+    n -= block_n;
+  }
+}
+
 void process_new_value(observable_value_t *ov, number_type new_value) {
   observable_number_t value_ = {
     .value = new_value
   };
   ov->set(ov, value_);
 }
+
+#if PIPELINE_STATS_MODE==1
+static void cycle_stats_reset(sensor_cycle_stats_t *stats)
+{
+  memset(stats, 0, sizeof(*stats));
+}
+
+static void filter_stats_reset(filter_item_t *fi)
+{
+  memset(&fi->stats, 0, sizeof(fi->stats));
+}
+
+void sensor_stats_reset(void)
+{
+  for (size_t i = 0; i < stats_observables_count; i++)
+  {
+    observable_value_t *ov = stats_observables[i];
+    ov->stats.calls = 0;
+    ov->stats.accepted = 0;
+    if (ov->chain != NULL)
+    {
+      for (size_t stage = 0; stage < ov->chain->stages_count; stage++)
+        filter_stats_reset(ov->chain->stages[stage].filter);
+    }
+    for (filter_item_t *fi = ov->filters; fi != NULL; fi = fi->next)
+      filter_stats_reset(fi);
+    for (int slot = 0; slot < SENSOR_MAX_OBSERVERS; slot++)
+      cycle_stats_reset(&ov->observers[slot].stats);
+  }
+}
+
+// cycles as min/mean/max, mean is 0 when nothing was measured
+static int cycle_stats_to_json(struct json_out *out, const sensor_cycle_stats_t *stats)
+{
+  uint32_t mean = stats->count > 0 ? (uint32_t)(stats->total / stats->count) : 0;
+  return json_printf(out, "count:%u, min:%u, mean:%u, max:%u",
+                     (unsigned)stats->count, (unsigned)stats->min, (unsigned)mean, (unsigned)stats->max);
+}
+
+static int filter_stats_to_json(struct json_out *out, const char *name, const filter_item_t *fi)
+{
+  int len = 0;
+  len += json_printf(out, "{name:%Q, continued:%u, stopped:%u, ",
+                     name, (unsigned)fi->stats.continued, (unsigned)fi->stats.stopped);
+  len += cycle_stats_to_json(out, &fi->stats.cycles);
+  len += json_printf(out, "}");
+  return len;
+}
+
+int sensor_stats_to_json(struct json_out *out)
+{
+  int len = 0;
+  len += json_printf(out, "{cycles_per_us:%u, observables:[", (unsigned)bench_cycles_per_us());
+  for (size_t i = 0; i < stats_observables_count; i++)
+  {
+    const observable_value_t *ov = stats_observables[i];
+    len += json_printf(out, "%s{name:%Q, calls:%u, accepted:%u, last_value:%.3f, filters:[",
+                       i > 0 ? ", " : "", ov->name, (unsigned)ov->stats.calls,
+                       (unsigned)ov->stats.accepted, ov->stats.last_value);
+    const char *sep = "";
+    if (ov->chain != NULL)
+    {
+      for (size_t stage = 0; stage < ov->chain->stages_count; stage++)
+      {
+        len += json_printf(out, "%s", sep);
+        len += filter_stats_to_json(out, ov->chain->stages[stage].name, ov->chain->stages[stage].filter);
+        sep = ", ";
+      }
+    }
+    // filters added at runtime have no name
+    for (const filter_item_t *fi = ov->filters; fi != NULL; fi = fi->next)
+    {
+      len += json_printf(out, "%s", sep);
+      len += filter_stats_to_json(out, NULL, fi);
+      sep = ", ";
+    }
+    len += json_printf(out, "], observers:[");
+    sep = "";
+    for (int slot = 0; slot < ov->observers_count; slot++)
+    {
+      if (ov->observers[slot].observer == NULL)
+        continue;
+      len += json_printf(out, "%s{slot:%d, ", sep, slot);
+      len += cycle_stats_to_json(out, &ov->observers[slot].stats);
+      len += json_printf(out, "}");
+      sep = ", ";
+    }
+    len += json_printf(out, "]}");
+  }
+  len += json_printf(out, "]}");
+  return len;
+}
+#endif
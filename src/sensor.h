@@ -3,6 +3,7 @@
 #include "stdlib.h"
 #include "stdbool.h"
 #include "stdint.h"
+#include "assert.h"
 
 typedef struct observable_value observable_value_t;
 
@@ -14,6 +15,65 @@ struct observable_number
   number_type value;
 };
 
+// optional instrumentation of the pipeline, PIPELINE_STATS_MODE=1 in mos.yml
+// compiles to nothing otherwise
+#if PIPELINE_STATS_MODE==1
+#include "bench.h"
+
+typedef struct sensor_cycle_stats sensor_cycle_stats_t;
+struct sensor_cycle_stats
+{
+  uint32_t count;
+  bench_cycles_t min;
+  bench_cycles_t max;
+  uint64_t total;
+};
+
+static inline void sensor_cycle_stats_add(sensor_cycle_stats_t *stats, bench_cycles_t cycles)
+{
+  if (stats->count == 0 || cycles < stats->min)
+    stats->min = cycles;
+  if (cycles > stats->max)
+    stats->max = cycles;
+  stats->total += cycles;
+  stats->count++;
+}
+
+typedef struct filter_stats filter_stats_t;
+struct filter_stats
+{
+  sensor_cycle_stats_t cycles;
+  uint32_t continued;
+  uint32_t stopped;
+};
+
+typedef struct observable_stats observable_stats_t;
+struct observable_stats
+{
+  uint32_t calls;
+  uint32_t accepted;
+  double last_value;
+  bool registered;
+};
+
+#define SENSOR_STATS_MEMBER(member) member;
+#define SENSOR_STATS_BEGIN(start) bench_cycles_t start = bench_cycles()
+#define SENSOR_STATS_FILTER(fi, start, continued_val, stopped_val)      \
+  do                                                                   \
+  {                                                                    \
+    sensor_cycle_stats_add(&(fi)->stats.cycles, bench_cycles() - (start)); \
+    (fi)->stats.continued += (continued_val);                          \
+    (fi)->stats.stopped += (stopped_val);                              \
+  } while (0)
+#define SENSOR_STATS_CYCLES(stats_member, start) \
+  sensor_cycle_stats_add(&(stats_member), bench_cycles() - (start))
+#else
+#define SENSOR_STATS_MEMBER(member)
+#define SENSOR_STATS_BEGIN(start)
+#define SENSOR_STATS_FILTER(fi, start, continued_val, stopped_val)
+#define SENSOR_STATS_CYCLES(stats_member, start)
+#endif
+
 typedef enum filter_ret_val filter_ret_val_t;
 enum filter_ret_val
 {
@@ -24,10 +84,16 @@ enum filter_ret_val
 
 typedef struct filter_item filter_item_t;
 typedef filter_ret_val_t (*value_filter_fn)(filter_item_t *, observable_number_t *);
+// filters a block of samples in place, returns how many samples are left
+// for the next filter in the chain
+typedef size_t (*value_block_filter_fn)(filter_item_t *, number_type *, size_t);
 struct filter_item
 {
   value_filter_fn filter;
+  // optional, samples go one by one through filter when not set
+  value_block_filter_fn block_filter;
   filter_item_t *next;
+  SENSOR_STATS_MEMBER(filter_stats_t stats)
 };
 
 void add_filter(observable_value_t *ov, filter_item_t *fi);
@@ -98,12 +164,481 @@ struct filter_item_clamp
   number_type max;
 };
 
+// linear fit, clamp, linear fit folded into one kernel
+// see filter_affine_clamp_fuse
+typedef struct filter_item_affine_clamp filter_item_affine_clamp_t;
+struct filter_item_affine_clamp
+{
+  filter_item_t super;
+  number_type slope;
+  number_type intercept;
+  number_type min;
+  number_type max;
+};
+
+bool filter_affine_clamp_fuse(filter_item_affine_clamp_t *this,
+                              const filter_item_linear_fit_t *fit_in,
+                              const filter_item_clamp_t *clamp,
+                              const filter_item_linear_fit_t *fit_out);
+
+// calibration curve through points_count points, x increasing
+// between the points the curve is linear, or a monotone cubic when
+// monotone is set (Fritsch-Carlson tangents, no overshoot between points
+// of a monotone table), outside of them it is held at the end values
+// the interval is found with a binary search over the points
+#ifndef SENSOR_CALIBRATION_MAX_POINTS
+#define SENSOR_CALIBRATION_MAX_POINTS 16
+#endif
+
+typedef struct filter_item_calibration filter_item_calibration_t;
+struct filter_item_calibration
+{
+  filter_item_t super;
+  bool monotone;
+  uint8_t points_count;
+  float x[SENSOR_CALIBRATION_MAX_POINTS];
+  float y[SENSOR_CALIBRATION_MAX_POINTS];
+  // slope of each interval and tangent at each point
+  float slopes_[SENSOR_CALIBRATION_MAX_POINTS];
+  float tangents_[SENSOR_CALIBRATION_MAX_POINTS];
+};
+
+// checks the points and calculates slopes and tangents
+// false for less than two points or x not increasing
+bool filter_calibration_calc(filter_item_calibration_t *this);
+
+// Kalman filter on level and rate of change, constant rate model
+// the rate is a random walk with process_noise (units^2/s^3), a sample has
+// measurement_noise variance (units^2). dt is the time since the previous
+// sample in seconds, the caller updates it when the sampling is not
+// regular. The initial rate variance is process_noise * dt (units^2/s^2).
+// While overflow is set the reading carries dynamic pressure, its variance
+// is scaled by overflow_noise_scale so the level only follows it slowly,
+// and the rate is held at 0. One output every output_every samples
+typedef struct filter_item_kalman_level filter_item_kalman_level_t;
+struct filter_item_kalman_level
+{
+  filter_item_t super;
+  float dt;
+  float process_noise;
+  float measurement_noise;
+  float overflow_noise_scale;
+  uint16_t output_every;
+  bool overflow;
+  bool initialized;
+  uint16_t sample_counter_;
+  number_type level_;
+  number_type rate_;
+  float p_[2][2];
+};
+
+// CIC decimator, order integrators at the input rate, order combs at the
+// output rate, one output per decimation samples, gain decimation^order
+// is divided out. Samples are rounded to integers, the registers wrap
+// modulo 2^64 which is exact as long as
+// order * log2(decimation) + bits of the input stays below 63
+// the first order - 1 outputs come from a partly filled filter and are dropped
+#ifndef SENSOR_CIC_MAX_ORDER
+#define SENSOR_CIC_MAX_ORDER 4
+#endif
+
+typedef struct filter_item_cic filter_item_cic_t;
+struct filter_item_cic
+{
+  filter_item_t super;
+  uint8_t order;
+  uint16_t decimation;
+  bool initialized;
+  uint8_t warmup_;
+  uint16_t sample_counter_;
+  number_type gain_;
+  uint64_t integrators_[SENSOR_CIC_MAX_ORDER];
+  uint64_t combs_[SENSOR_CIC_MAX_ORDER];
+};
+
+void filter_cic_reset(filter_item_cic_t *this);
+
+// sliding window filters keep the last window_size samples in a ring
+// buffer inside the filter item, nothing is allocated per sample
+#ifndef SENSOR_WINDOW_MAX_SIZE
+#define SENSOR_WINDOW_MAX_SIZE 32
+#endif
+
+// mean over the last window_size samples with a running sum
+// the sum is recomputed from the ring once per lap against rounding drift
+typedef struct filter_item_sliding_mean filter_item_sliding_mean_t;
+struct filter_item_sliding_mean
+{
+  filter_item_t super;
+  uint8_t window_size;
+  uint8_t index_;
+  uint8_t count_;
+  number_type sum_;
+  number_type window_[SENSOR_WINDOW_MAX_SIZE];
+};
+
+// running median of the last size samples in O(log size) per sample
+// the window is split in a max heap below and a min heap above the median,
+// heap_ is indexed from -size/2 to size/2 around the median at 0 and holds
+// ring positions, pos_ maps a ring position back to its heap index
+typedef struct sensor_running_median sensor_running_median_t;
+struct sensor_running_median
+{
+  uint8_t size;
+  uint8_t index_;
+  uint8_t count_;
+  number_type data_[SENSOR_WINDOW_MAX_SIZE];
+  int8_t pos_[SENSOR_WINDOW_MAX_SIZE];
+  int8_t heap_[SENSOR_WINDOW_MAX_SIZE];
+};
+
+void running_median_init(sensor_running_median_t *rm, uint8_t size);
+void running_median_insert(sensor_running_median_t *rm, number_type value);
+number_type running_median_get(const sensor_running_median_t *rm);
+
+// least squares line through the last size (x, y) points, O(1) per point
+// the sums are relative to x0_ against cancellation and are recomputed
+// from the ring once per lap against rounding drift
+typedef struct sensor_window_regression sensor_window_regression_t;
+struct sensor_window_regression
+{
+  uint8_t size;
+  uint8_t index_;
+  uint8_t count_;
+  double x0_;
+  double sum_x_;
+  double sum_y_;
+  double sum_xx_;
+  double sum_xy_;
+  double x_[SENSOR_WINDOW_MAX_SIZE];
+  number_type y_[SENSOR_WINDOW_MAX_SIZE];
+};
+
+void window_regression_init(sensor_window_regression_t *wr, uint8_t size);
+void window_regression_add(sensor_window_regression_t *wr, double x, number_type y);
+// false with less than two points or a single x
+bool window_regression_slope(const sensor_window_regression_t *wr, number_type *slope);
+
+// recursive least squares fit of y = theta . x over k regressors
+// O(k^2) per update, no history, older samples are forgotten by lambda
+// p is the covariance of theta scaled by the noise, started at delta * I
+#ifndef SENSOR_RLS_MAX_K
+#define SENSOR_RLS_MAX_K 3
+#endif
+
+typedef struct sensor_rls sensor_rls_t;
+struct sensor_rls
+{
+  uint8_t k;
+  float lambda;
+  float theta[SENSOR_RLS_MAX_K];
+  float p[SENSOR_RLS_MAX_K][SENSOR_RLS_MAX_K];
+  uint32_t updates;
+};
+
+// theta starts at the given prior, NULL for zeros
+void sensor_rls_init(sensor_rls_t *rls, uint8_t k, float lambda, float delta, const float *theta);
+float sensor_rls_predict(const sensor_rls_t *rls, const float *x);
+// returns the a priori error y - theta . x
+float sensor_rls_update(sensor_rls_t *rls, const float *x, float y);
+
+typedef struct filter_item_moving_median filter_item_moving_median_t;
+struct filter_item_moving_median
+{
+  filter_item_t super;
+  uint8_t window_size;
+  bool initialized;
+  sensor_running_median_t median_;
+};
+
+// Hampel identifier, a sample further than threshold * 1.4826 * MAD from
+// the window median is an outlier, MAD being the median absolute deviation
+// min_deviation keeps a flat window with MAD 0 from rejecting every change
+// outliers are replaced with the median or dropped when replace is false
+typedef struct filter_item_hampel filter_item_hampel_t;
+struct filter_item_hampel
+{
+  filter_item_t super;
+  uint8_t window_size;
+  float threshold;
+  number_type min_deviation;
+  bool replace;
+  bool initialized;
+  uint32_t outliers;
+  sensor_running_median_t median_;
+};
+
+// filter kernels, inlined in static chains and wrapped by the filter_item_*_fn
+static inline filter_ret_val_t filter_item_clamp_apply(filter_item_clamp_t *fi, observable_number_t *var)
+{
+  if (var->value < fi->min)
+    var->value = fi->min;
+  if (var->value > fi->max)
+    var->value = fi->max;
+  return FILTER_CONTINUE;
+}
+
+static inline filter_ret_val_t filter_item_offset_apply(filter_item_offset_t *fi, observable_number_t *var)
+{
+  var->value += fi->offset;
+  return FILTER_CONTINUE;
+}
+
+static inline filter_ret_val_t filter_item_skip_apply(filter_item_skip_t *fi, observable_number_t *var)
+{
+  if (fi->skip > 0)
+  {
+    fi->skip--;
+    return FILTER_STOP;
+  }
+  return FILTER_CONTINUE;
+}
+
+static inline filter_ret_val_t filter_item_exp_moving_average_apply(filter_item_exp_moving_average_t *fi, observable_number_t *var)
+{
+  if (fi->initialized == false)
+  {
+    fi->previous_value = var->value;
+    fi->initialized = true;
+  }
+  if (fi->pass_first)
+  {
+    fi->pass_first = false;
+    return FILTER_CONTINUE;
+  }
+  var->value = fi->previous_value + fi->alpha * (var->value - fi->previous_value);
+  fi->previous_value = var->value;
+
+  return FILTER_CONTINUE;
+}
+
+static inline filter_ret_val_t filter_item_average_apply(filter_item_average_t *fi, observable_number_t *var)
+{
+  assert(fi->number_of_samples > 0);
+  fi->accumulator_ += var->value;
+  fi->sample_counter_--;
+  if (fi->sample_counter_ > 0)
+    return FILTER_STOP;
+
+  var->value = fi->accumulator_ / fi->number_of_samples;
+  fi->accumulator_ = 0;
+  fi->sample_counter_ = fi->number_of_samples;
+
+  return FILTER_CONTINUE;
+}
+
+static inline filter_ret_val_t filter_item_harmonic_average_apply(filter_item_harmonic_average_t *fi, observable_number_t *var)
+{
+  assert(fi->number_of_samples > 0);
+  fi->accumulator_ += 1/var->value;
+  fi->sample_counter_--;
+  if (fi->sample_counter_ > 0)
+    return FILTER_STOP;
+
+  var->value = fi->number_of_samples / fi->accumulator_;
+  fi->accumulator_ = 0;
+  fi->sample_counter_ = fi->number_of_samples;
+
+  return FILTER_CONTINUE;
+}
+
+static inline filter_ret_val_t filter_item_linear_fit_apply(filter_item_linear_fit_t *fi, observable_number_t *var)
+{
+  assert(fi->value_map[0][0] != fi->value_map[1][0]);
+  var->value = fi->slope_ * var->value + fi->intercept_;
+  return FILTER_CONTINUE;
+}
+
+static inline filter_ret_val_t filter_item_affine_clamp_apply(filter_item_affine_clamp_t *fi, observable_number_t *var)
+{
+  number_type value = fi->slope * var->value + fi->intercept;
+  if (value < fi->min)
+    value = fi->min;
+  if (value > fi->max)
+    value = fi->max;
+  var->value = value;
+  return FILTER_CONTINUE;
+}
+
+static inline filter_ret_val_t filter_item_calibration_apply(filter_item_calibration_t *fi, observable_number_t *var)
+{
+  assert(fi->points_count >= 2);
+  float x = var->value;
+  uint8_t last = fi->points_count - 1;
+  if (x <= fi->x[0])
+  {
+    var->value = fi->y[0];
+    return FILTER_CONTINUE;
+  }
+  if (x >= fi->x[last])
+  {
+    var->value = fi->y[last];
+    return FILTER_CONTINUE;
+  }
+  // x[low] <= x < x[high]
+  uint8_t low = 0, high = last;
+  while (high - low > 1)
+  {
+    uint8_t middle = (low + high) / 2;
+    if (x < fi->x[middle])
+      high = middle;
+    else
+      low = middle;
+  }
+  float dx = x - fi->x[low];
+  if (fi->monotone == false)
+  {
+    var->value = fi->y[low] + fi->slopes_[low] * dx;
+    return FILTER_CONTINUE;
+  }
+  // cubic Hermite on the interval
+  float h = fi->x[high] - fi->x[low];
+  float c2 = (3 * fi->slopes_[low] - 2 * fi->tangents_[low] - fi->tangents_[high]) / h;
+  float c3 = (fi->tangents_[low] + fi->tangents_[high] - 2 * fi->slopes_[low]) / (h * h);
+  var->value = fi->y[low] + dx * (fi->tangents_[low] + dx * (c2 + dx * c3));
+  return FILTER_CONTINUE;
+}
+
+static inline filter_ret_val_t filter_item_sliding_mean_apply(filter_item_sliding_mean_t *fi, observable_number_t *var)
+{
+  assert(fi->window_size > 0 && fi->window_size <= SENSOR_WINDOW_MAX_SIZE);
+  if (fi->count_ < fi->window_size)
+    fi->count_++;
+  else
+    fi->sum_ -= fi->window_[fi->index_];
+  fi->window_[fi->index_] = var->value;
+  fi->sum_ += var->value;
+  if (++fi->index_ == fi->window_size)
+  {
+    fi->index_ = 0;
+    fi->sum_ = 0;
+    for (uint8_t i = 0; i < fi->count_; i++)
+      fi->sum_ += fi->window_[i];
+  }
+  var->value = fi->sum_ / fi->count_;
+  return FILTER_CONTINUE;
+}
+
+static inline filter_ret_val_t filter_item_cic_apply(filter_item_cic_t *fi, observable_number_t *var)
+{
+  if (fi->initialized == false)
+    filter_cic_reset(fi);
+  number_type rounded = var->value >= 0 ? var->value + 0.5 : var->value - 0.5;
+  uint64_t acc = (uint64_t)(int64_t)rounded;
+  for (uint8_t i = 0; i < fi->order; i++)
+  {
+    fi->integrators_[i] += acc;
+    acc = fi->integrators_[i];
+  }
+  if (--fi->sample_counter_ > 0)
+    return FILTER_STOP;
+  fi->sample_counter_ = fi->decimation;
+
+  for (uint8_t i = 0; i < fi->order; i++)
+  {
+    uint64_t delayed = fi->combs_[i];
+    fi->combs_[i] = acc;
+    acc -= delayed;
+  }
+  if (fi->warmup_ > 0)
+  {
+    fi->warmup_--;
+    return FILTER_STOP;
+  }
+  var->value = (int64_t)acc / fi->gain_;
+  return FILTER_CONTINUE;
+}
+
+// too big to inline, static chains call them directly
+filter_ret_val_t filter_item_moving_median_apply(filter_item_moving_median_t *fi, observable_number_t *var);
+filter_ret_val_t filter_item_hampel_apply(filter_item_hampel_t *fi, observable_number_t *var);
+filter_ret_val_t filter_item_kalman_level_apply(filter_item_kalman_level_t *fi, observable_number_t *var);
+
 filter_ret_val_t filter_item_linear_fit_fn(filter_item_t *this, observable_number_t *var);
 filter_ret_val_t filter_item_exp_moving_average_fn(filter_item_t *this, observable_number_t *var);
 filter_ret_val_t filter_item_average_fn(filter_item_t *this, observable_number_t *var);
 filter_ret_val_t filter_item_clamp_fn(filter_item_t *this, observable_number_t *var);
 filter_ret_val_t filter_item_offset_fn(filter_item_t *this, observable_number_t *var);
 filter_ret_val_t filter_item_skip_fn(filter_item_t *this, observable_number_t *var);
+filter_ret_val_t filter_item_harmonic_average_fn(filter_item_t *this, observable_number_t *var);
+filter_ret_val_t filter_item_affine_clamp_fn(filter_item_t *this, observable_number_t *var);
+filter_ret_val_t filter_item_calibration_fn(filter_item_t *this, observable_number_t *var);
+filter_ret_val_t filter_item_sliding_mean_fn(filter_item_t *this, observable_number_t *var);
+filter_ret_val_t filter_item_cic_fn(filter_item_t *this, observable_number_t *var);
+filter_ret_val_t filter_item_moving_median_fn(filter_item_t *this, observable_number_t *var);
+filter_ret_val_t filter_item_hampel_fn(filter_item_t *this, observable_number_t *var);
+filter_ret_val_t filter_item_kalman_level_fn(filter_item_t *this, observable_number_t *var);
+
+size_t filter_item_linear_fit_block_fn(filter_item_t *this, number_type *values, size_t n);
+size_t filter_item_exp_moving_average_block_fn(filter_item_t *this, number_type *values, size_t n);
+size_t filter_item_average_block_fn(filter_item_t *this, number_type *values, size_t n);
+size_t filter_item_harmonic_average_block_fn(filter_item_t *this, number_type *values, size_t n);
+size_t filter_item_clamp_block_fn(filter_item_t *this, number_type *values, size_t n);
+size_t filter_item_offset_block_fn(filter_item_t *this, number_type *values, size_t n);
+size_t filter_item_skip_block_fn(filter_item_t *this, number_type *values, size_t n);
+size_t filter_item_affine_clamp_block_fn(filter_item_t *this, number_type *values, size_t n);
+size_t filter_item_calibration_block_fn(filter_item_t *this, number_type *values, size_t n);
+size_t filter_item_sliding_mean_block_fn(filter_item_t *this, number_type *values, size_t n);
+size_t filter_item_cic_block_fn(filter_item_t *this, number_type *values, size_t n);
+size_t filter_item_moving_median_block_fn(filter_item_t *this, number_type *values, size_t n);
+size_t filter_item_hampel_block_fn(filter_item_t *this, number_type *values, size_t n);
+size_t filter_item_kalman_level_block_fn(filter_item_t *this, number_type *values, size_t n);
+
+// static chains
+// the stages of a chain known at build time are listed in an X-macro
+// and expand to direct calls of the inline kernels, no list walk and no
+// indirect calls per sample, see PRESSURE_CHAIN in sensor_pressure.c
+// the static chain runs first, filters added with add_filter run after it
+typedef filter_ret_val_t (*filter_chain_fn)(observable_number_t *);
+
+typedef struct filter_chain_stage filter_chain_stage_t;
+struct filter_chain_stage
+{
+  const char *name;
+  filter_item_t *filter;
+};
+
+typedef struct filter_chain filter_chain_t;
+struct filter_chain
+{
+  filter_chain_fn run;
+  const filter_chain_stage_t *stages;
+  size_t stages_count;
+};
+
+#define FILTER_CHAIN_STAGE(type, filter_name)                                 \
+  {                                                                           \
+    SENSOR_STATS_BEGIN(stage_start_);                                         \
+    chain_ret_val = filter_item_##type##_apply(&filter_name, var);            \
+    SENSOR_STATS_FILTER(&filter_name.super, stage_start_,                     \
+                        chain_ret_val == FILTER_CONTINUE,                     \
+                        chain_ret_val != FILTER_CONTINUE);                    \
+    if (chain_ret_val != FILTER_CONTINUE)                                     \
+      return chain_ret_val;                                                   \
+  }
+
+#define FILTER_CHAIN_STAGE_ITEM(type, filter_name) \
+  {.name = #filter_name, .filter = &filter_name.super},
+
+#define FILTER_CHAIN(chain_name, chain_list)                                         \
+  static filter_ret_val_t chain_name##_run(observable_number_t *var)                 \
+  {                                                                                  \
+    filter_ret_val_t chain_ret_val = FILTER_CONTINUE;                                \
+    chain_list(FILTER_CHAIN_STAGE)                                                   \
+    return chain_ret_val;                                                            \
+  }                                                                                  \
+  static const filter_chain_stage_t chain_name##_stages[] = {                        \
+      chain_list(FILTER_CHAIN_STAGE_ITEM)};                                          \
+  static const filter_chain_t chain_name = {                                         \
+      .run = chain_name##_run,                                                       \
+      .stages = chain_name##_stages,                                                 \
+      .stages_count = sizeof(chain_name##_stages) / sizeof(chain_name##_stages[0]),  \
+  };
+
+// observers live in a fixed table in each observable, no heap use after init
+#ifndef SENSOR_MAX_OBSERVERS
+#define SENSOR_MAX_OBSERVERS 4
+#endif
 
 typedef void (*value_observer_cb)(observable_value_t *);
 
@@ -111,31 +646,50 @@ typedef struct value_observer_item value_observer_item_t;
 struct value_observer_item
 {
   value_observer_cb observer;
-  value_observer_item_t *next;
+  SENSOR_STATS_MEMBER(sensor_cycle_stats_t stats)
 };
 
 typedef void (*set_value_fn)(observable_value_t *, observable_number_t);
 typedef void (*process_value_fn)(observable_value_t *, number_type);
 typedef void (*notify_observers_fn)(observable_value_t *);
 
-void add_observer(observable_value_t *ov, value_observer_cb observer_cb);
+// returns the observer slot, -1 when the table is full
+int add_observer(observable_value_t *ov, value_observer_cb observer_cb);
 void remove_observer(observable_value_t *ov, value_observer_cb observer_cb);
+void remove_observer_slot(observable_value_t *ov, int slot);
 void cleanup_observers(observable_value_t *ov);
 void notify_observers(observable_value_t *ov);
 void set_value(observable_value_t *ov, observable_number_t new_value);
 void process_new_value(observable_value_t *ov, number_type new_value);
+// block variants, observers are notified once for every sample that passes the filters
+#define SENSOR_BLOCK_SIZE 64
+void set_values(observable_value_t *ov, number_type *new_values, size_t n);
+void process_new_values(observable_value_t *ov, const number_type *samples, size_t n);
 
 struct observable_value
 {
   char name[20];
   observable_number_t value;
+  // optional static chain, runs before filters
+  const filter_chain_t *chain;
   filter_item_t *filters;
-  value_observer_item_t *observers;
+  value_observer_item_t observers[SENSOR_MAX_OBSERVERS];
+  // slots in use are below this mark, removed ones are left empty
+  uint8_t observers_count;
   set_value_fn set;
   process_value_fn process;
   notify_observers_fn notify;
+  SENSOR_STATS_MEMBER(observable_stats_t stats)
 };
 
+#if PIPELINE_STATS_MODE==1
+struct json_out;
+// observables register on their first value
+#define SENSOR_STATS_MAX_OBSERVABLES 8
+void sensor_stats_reset(void);
+int sensor_stats_to_json(struct json_out *out);
+#endif
+
 #define OBSERVABLE_NUMBER(var_name, initial_value) \
   observable_number_t var_name = {                 \
       .value = initial_value,                      \
@@ -150,8 +704,8 @@ struct observable_value
   observable_value_t var_name __attribute__((__cleanup__(cleanup_observers))) = { \
       .value = initial_value,                                                     \
       .name = #var_name,                                                          \
+      .chain = NULL,                                                              \
       .filters = NULL,                                                            \
-      .observers = NULL,                                                          \
       .set = set_value,                                                           \
       .process = process_new_value,                                               \
       .notify = notify_observers,                                                 \
@@ -160,6 +714,9 @@ struct observable_value
 #define PROCESS_NEW_VALUE(var_name, var_value) \
   var_name.process(&var_name, var_value)
 
+#define PROCESS_NEW_VALUES(var_name, samples, n) \
+  process_new_values(&var_name, samples, n)
+
 #define ADD_OBSERVER(var_name, observer) \
   add_observer(&var_name, observer)
 
@@ -172,9 +729,10 @@ struct observable_value
 #define NOTIFY_OBSERVERS(var_name) \
   var_name.notify(&var_name)
 
-#define FILTER(filter_name, type)              \
-  filter_item_##type##_t filter_name = {       \
-      .super.filter = filter_item_##type##_fn, \
+#define FILTER(filter_name, type)                          \
+  filter_item_##type##_t filter_name = {                   \
+      .super.filter = filter_item_##type##_fn,             \
+      .super.block_filter = filter_item_##type##_block_fn, \
   }
 
 #define FILTER_CLAMP(filter_name, min_val, max_val) \
@@ -220,5 +778,54 @@ struct observable_value
   filter_name.slope_ = ((float)to_1 - (float)to_2) / ((float)from_1 - (float)from_2); \
   filter_name.intercept_ = (float)to_1 - filter_name.slope_ * (float)from_1;
 
+#define FILTER_AFFINE_CLAMP(filter_name, slope_val, intercept_val, min_val, max_val) \
+  FILTER(filter_name, affine_clamp);                                                \
+  filter_name.slope = slope_val;                                                    \
+  filter_name.intercept = intercept_val;                                            \
+  filter_name.min = min_val;                                                        \
+  filter_name.max = max_val;
+
+#define FILTER_CALIBRATION(filter_name, monotone_val) \
+  FILTER(filter_name, calibration);                  \
+  filter_name.monotone = monotone_val;               \
+  filter_name.points_count = 0;
+
+#define FILTER_CIC(filter_name, order_val, decimation_val) \
+  FILTER(filter_name, cic);                               \
+  filter_name.order = order_val;                          \
+  filter_name.decimation = decimation_val;                \
+  filter_name.initialized = false;
+
+#define FILTER_SLIDING_MEAN(filter_name, window_size_val) \
+  FILTER(filter_name, sliding_mean);                       \
+  filter_name.window_size = window_size_val;               \
+  filter_name.index_ = 0;                                  \
+  filter_name.count_ = 0;                                  \
+  filter_name.sum_ = 0;
+
+#define FILTER_MOVING_MEDIAN(filter_name, window_size_val) \
+  FILTER(filter_name, moving_median);                      \
+  filter_name.window_size = window_size_val;               \
+  filter_name.initialized = false;
+
+#define FILTER_HAMPEL(filter_name, window_size_val, threshold_val, min_deviation_val, replace_val) \
+  FILTER(filter_name, hampel);                                                                   \
+  filter_name.window_size = window_size_val;                                                     \
+  filter_name.threshold = threshold_val;                                                         \
+  filter_name.min_deviation = min_deviation_val;                                                 \
+  filter_name.replace = replace_val;                                                             \
+  filter_name.initialized = false;                                                               \
+  filter_name.outliers = 0;
+
+#define FILTER_KALMAN_LEVEL(filter_name, dt_val, process_noise_val, measurement_noise_val, output_every_val) \
+  FILTER(filter_name, kalman_level);                                                                      \
+  filter_name.dt = dt_val;                                                                                \
+  filter_name.process_noise = process_noise_val;                                                          \
+  filter_name.measurement_noise = measurement_noise_val;                                                  \
+  filter_name.overflow_noise_scale = 100;                                                                 \
+  filter_name.output_every = output_every_val;                                                            \
+  filter_name.overflow = false;                                                                           \
+  filter_name.initialized = false;
+
 #define ADD_FILTER(var_name, filter) \
   add_filter(&var_name, (filter_item_t *)&filter);
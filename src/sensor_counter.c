@@ -7,14 +7,20 @@
  */
 
 #include "sensor_counter.h"
+#include "spsc_ring.h"
 
 #include "mgos_freertos.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "driver/gpio.h"
 #include "driver/pcnt.h"
 #include "driver/rmt.h"
 
+#if FREQUENCY_GAPLESS==1 && FREQUENCY_PERIOD==1
+#error "FREQUENCY_GAPLESS and FREQUENCY_PERIOD are alternative counter modes"
+#endif
+
 //can be disabled in mos.yml by setting the var to != 1
 #if FREQUENCY_TEST_MODE==1
 #include "sensor_counter_test.h"
@@ -24,13 +30,14 @@
 
 static gpio_counter_t gpio_counter = {
     .count = 0,
-    .frequency = 0};
+    .frequency = 0,
+    .timestamp_us = 0};
 
-// use this for the intermediary readings
-// to compare against last reported
-static gpio_counter_t gpio_counter_reading = {
-    .count = 0,
-    .frequency = 0};
+// readings from the counter task to the mgos task, no reading is lost
+// or torn while the mgos task is busy unless the ring fills up
+#define READING_RING_SIZE 8
+static gpio_counter_t reading_ring_items[READING_RING_SIZE];
+static spsc_ring_t reading_ring;
 
 #define RMT_MEM_BLOCK_BYTE_NUM RMT_MEM_ITEM_NUM
 
@@ -60,6 +67,50 @@ static const float sampling_window_sec = 1;
 // how much to load in RMT
 static const float sampling_period_sec = 1.1;
 
+#if FREQUENCY_GAPLESS==1
+// gapless mode, no RMT gate, PCNT counts all the time and is read
+// at the end of each sub-gate, the frequency is over the last
+// SUB_GATES_NUM sub-gates, so a sliding window of 1s every 100ms
+#define SUB_GATES_NUM 10
+static const float sub_gate_sec = 0.1;
+// the counter wraps to 0 when it reaches the high limit
+static const int16_t pcnt_gapless_h_lim = 32767;
+
+typedef struct sub_gate_ring {
+  uint16_t counts[SUB_GATES_NUM];
+  // measured, the task wakes up with some jitter
+  int32_t durations_us[SUB_GATES_NUM];
+  uint8_t index;
+  uint8_t filled;
+  uint32_t count_sum;
+  int64_t duration_sum_us;
+} sub_gate_ring_t;
+
+static sub_gate_ring_t sub_gate_ring;
+#endif
+
+#if FREQUENCY_PERIOD==1
+// period mode, rising edges are timestamped in an ISR and the frequency
+// is the whole periods between the last edges seen by two reads over
+// the time between those edges, at 1us this is 0.0002Hz around 15Hz
+static const float period_read_sec = 0.1;
+// without edges for this long the frequency is 0
+static const int64_t period_timeout_us = 2000000;
+// same as the PCNT filter, closer edges are noise
+static const int64_t period_min_edge_us = 13;
+// the count is over the last 1s of reads, as in the other modes
+#define PERIOD_COUNT_READS 10
+
+typedef struct period_capture {
+  uint32_t edges;
+  int64_t last_edge_us;
+} period_capture_t;
+
+// written in the ISR, the task copies it under the lock
+static period_capture_t period_capture;
+static portMUX_TYPE period_capture_mux = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
 // static const gpio_num_t pulse_gpio_pin = GPIO_NUM_34;
 static gpio_num_t pulse_gpio_pin = GPIO_NUM_16;
 static const pcnt_unit_t pcnt_unit = PCNT_UNIT_0;
@@ -75,9 +126,27 @@ static const pcnt_channel_t pcnt_channel = PCNT_CHANNEL_0;
 // depending on pulse source this migth need to be reduced
 static const uint16_t pcnt_filter_length = 1023;
 
+// overflow alarm on the PCNT watch points in the gate mode, thres1 at
+// the first edge of the window, thres0 at the edges of an overflow
+static volatile int16_t alarm_edges = 0;
+static volatile bool alarm_raised = false;
+// window state of the ISR, reset by the task at the start of a window
+static counter_alarm_t alarm_reading = {0};
+static counter_alarm_t counter_alarm = {0};
+// alarms from the ISR to the mgos task, a copy the next window can not reset
+#define ALARM_RING_SIZE 4
+static counter_alarm_t alarm_ring_items[ALARM_RING_SIZE];
+static spsc_ring_t alarm_ring;
+
 // task
 static TaskHandle_t frequency_task_handle;
+#if FREQUENCY_GAPLESS==1
+static const int task_delay_ticks = sub_gate_sec * 1000 / portTICK_RATE_MS;
+#elif FREQUENCY_PERIOD==1
+static const int task_delay_ticks = period_read_sec * 1000 / portTICK_RATE_MS;
+#else
 static const int task_delay_ticks = sampling_period_sec * 1000 / portTICK_RATE_MS;
+#endif
 static const uint32_t terminate_task = 0x01;
 
 void clear_task_handle_on_exit(void *arg UNUSED_ARG)
@@ -86,36 +155,33 @@ void clear_task_handle_on_exit(void *arg UNUSED_ARG)
   frequency_task_handle = NULL;
 }
 
-// emit the counter readings
-void process_counter_update(void *ard UNUSED_ARG)
+static void emit_counter_reading(void *item, void *user_data UNUSED_ARG)
 {
-  gpio_counter = gpio_counter_reading;
+  gpio_counter = *(gpio_counter_t *)item;
   mgos_event_trigger(COUNTER_CHANGE, &gpio_counter);
 }
 
-int frequency_count_init(void)
+// emit the counter readings, all queued in one pass
+void process_counter_update(void *arg UNUSED_ARG)
 {
-  // using one rmt block at this clock divider
-  // allows for a window of max 10 sec
-  rmt_config_t rmt_tx = {
-    .rmt_mode = RMT_MODE_TX,
-    .channel = rmt_channel,
-    .gpio_num = rmt_gpio_pin,
-    .clk_div = rmt_clk_div,
-    .mem_block_num = MAX_RMT_BLOCKS,
-    .flags = 0,
-    .tx_config = {
-      .loop_en = false,
-      .carrier_en = false,
-      .idle_output_en = true,
-      .idle_level = RMT_IDLE_LEVEL_LOW
-    }
-  };
-  ESP_ERROR_CHECK(rmt_config(&rmt_tx));
-  ESP_ERROR_CHECK(rmt_driver_install(rmt_tx.channel, 0, 0));
+  spsc_ring_drain(&reading_ring, emit_counter_reading, NULL);
+}
 
-  LOG(LL_INFO, ("%s, [FREQUENCY TASK] RMT Init", TAG));
+// on the counter task
+static void publish_counter_reading(uint16_t count, float frequency)
+{
+  gpio_counter_t reading = {
+      .count = count,
+      .frequency = frequency,
+      .timestamp_us = esp_timer_get_time()};
+  spsc_ring_push(&reading_ring, &reading);
+  if (spsc_ring_request_drain(&reading_ring) && !mgos_invoke_cb(process_counter_update, NULL, false))
+    spsc_ring_cancel_drain(&reading_ring);
+}
 
+// without a gate pin the counter runs freely
+static void frequency_count_pcnt_init(int ctrl_gpio_num, int16_t counter_h_lim)
+{
   pcnt_config_t pcnt_config = {
     .unit = pcnt_unit,
     //.unit = pcnt_unit,
@@ -123,14 +189,14 @@ int frequency_count_init(void)
     // input pin
     .pulse_gpio_num = pulse_gpio_pin,
     // control gate pin
-    .ctrl_gpio_num = rmt_gpio_pin,
+    .ctrl_gpio_num = ctrl_gpio_num,
     .hctrl_mode = PCNT_MODE_KEEP,
-    .lctrl_mode = PCNT_MODE_DISABLE,
+    .lctrl_mode = ctrl_gpio_num == PCNT_PIN_NOT_USED ? PCNT_MODE_KEEP : PCNT_MODE_DISABLE,
     // count both rising and falling edges
     .pos_mode = PCNT_COUNT_INC,
     .neg_mode = PCNT_COUNT_INC,
-    .counter_h_lim = 1000,
-    .counter_l_lim = -1000,
+    .counter_h_lim = counter_h_lim,
+    .counter_l_lim = -counter_h_lim,
   };
   ESP_ERROR_CHECK(pcnt_unit_config(&pcnt_config));
 
@@ -144,6 +210,84 @@ int frequency_count_init(void)
   #if FREQUENCY_TEST_MODE==1
     sensor_counter_test_init_gpio_output();
   #endif
+}
+
+static void emit_counter_alarm(void *item, void *user_data UNUSED_ARG)
+{
+  counter_alarm = *(counter_alarm_t *)item;
+  mgos_event_trigger(COUNTER_OVERFLOW_ALARM, &counter_alarm);
+}
+
+static void process_counter_alarm(void *arg UNUSED_ARG)
+{
+  spsc_ring_drain(&alarm_ring, emit_counter_alarm, NULL);
+}
+
+static void pcnt_alarm_isr(void *arg UNUSED_ARG)
+{
+  int16_t value;
+  int64_t now_us = esp_timer_get_time();
+  if (alarm_edges == 0)
+    return;
+  pcnt_get_counter_value(pcnt_unit, &value);
+  if (value < alarm_edges)
+  {
+    if (alarm_reading.first_pulse_us == 0)
+      alarm_reading.first_pulse_us = now_us;
+    return;
+  }
+  if (alarm_raised)
+    return;
+  alarm_raised = true;
+  if (alarm_reading.first_pulse_us == 0)
+    alarm_reading.first_pulse_us = now_us;
+  alarm_reading.alarm_us = now_us;
+  spsc_ring_push(&alarm_ring, &alarm_reading);
+  if (spsc_ring_request_drain(&alarm_ring) && !mgos_invoke_cb(process_counter_alarm, NULL, true))
+    spsc_ring_cancel_drain(&alarm_ring);
+}
+
+// report 0 and end the calling task
+static void frequency_count_task_exit(void)
+{
+  LOG(LL_INFO, ("%s, [FREQUENCY TASK] %u readings dropped", TAG, (unsigned)spsc_ring_overruns(&reading_ring)));
+
+  publish_counter_reading(0, 0);
+
+  mgos_invoke_cb(clear_task_handle_on_exit, NULL, false);
+
+  vTaskDelete(NULL);
+}
+
+int frequency_count_init(void)
+{
+  // using one rmt block at this clock divider
+  // allows for a window of max 10 sec
+  rmt_config_t rmt_tx = {
+    .rmt_mode = RMT_MODE_TX,
+    .channel = rmt_channel,
+    .gpio_num = rmt_gpio_pin,
+    .clk_div = rmt_clk_div,
+    .mem_block_num = MAX_RMT_BLOCKS,
+    .flags = 0,
+    .tx_config = {
+      .loop_en = false,
+      .carrier_en = false,
+      .idle_output_en = true,
+      .idle_level = RMT_IDLE_LEVEL_LOW
+    }
+  };
+  ESP_ERROR_CHECK(rmt_config(&rmt_tx));
+  ESP_ERROR_CHECK(rmt_driver_install(rmt_tx.channel, 0, 0));
+
+  LOG(LL_INFO, ("%s, [FREQUENCY TASK] RMT Init", TAG));
+
+  frequency_count_pcnt_init(rmt_gpio_pin, 1000);
+
+  pcnt_set_event_value(pcnt_unit, PCNT_EVT_THRES_1, 1);
+  pcnt_event_enable(pcnt_unit, PCNT_EVT_THRES_1);
+  ESP_ERROR_CHECK(pcnt_isr_service_install(0));
+  ESP_ERROR_CHECK(pcnt_isr_handler_add(pcnt_unit, pcnt_alarm_isr, NULL));
 
   *rmt_items = (rmt_item32_t){0};
 
@@ -179,6 +323,8 @@ int frequency_count_init(void)
 
 void frequency_count_teardown(void)
 {
+  pcnt_isr_handler_remove(pcnt_unit);
+  pcnt_isr_service_uninstall();
   ESP_ERROR_CHECK(rmt_driver_uninstall(rmt_channel));
 }
 
@@ -197,6 +343,18 @@ void frequency_count_task_function(void *pvParameter)
     double frequency_hz;
     // clear counter
     pcnt_counter_pause(pcnt_unit);
+    // no events while paused, the ISR sees a consistent alarm state
+    alarm_reading = (counter_alarm_t){0};
+    alarm_raised = false;
+    if (alarm_edges > 0)
+    {
+      pcnt_set_event_value(pcnt_unit, PCNT_EVT_THRES_0, alarm_edges);
+      pcnt_event_enable(pcnt_unit, PCNT_EVT_THRES_0);
+    }
+    else
+    {
+      pcnt_event_disable(pcnt_unit, PCNT_EVT_THRES_0);
+    }
     pcnt_counter_clear(pcnt_unit);
     pcnt_counter_resume(pcnt_unit);
     // start sampling window
@@ -214,10 +372,7 @@ void frequency_count_task_function(void *pvParameter)
     frequency_hz = pin_change_count / 2.0 / sampling_window_sec;
     LOG(LL_DEBUG, ("%s, [FREQUENCY TASK] frequency %f", TAG, frequency_hz));
 
-    gpio_counter_reading.count = pin_change_count;
-    gpio_counter_reading.frequency = frequency_hz;
-
-    mgos_invoke_cb(process_counter_update, NULL, false);
+    publish_counter_reading(pin_change_count, frequency_hz);
 
     if (ulTaskNotifyTake(pdFALSE, 0) == terminate_task)
       break;
@@ -234,21 +389,181 @@ void frequency_count_task_function(void *pvParameter)
   pcnt_counter_pause(pcnt_unit);
   pcnt_counter_clear(pcnt_unit);
 
-  gpio_counter_reading.count = 0;
-  gpio_counter_reading.frequency = 0;
+  frequency_count_task_exit();
+}
 
-  mgos_invoke_cb(process_counter_update, NULL, false);
+#if FREQUENCY_GAPLESS==1
+static void sub_gate_add(sub_gate_ring_t *ring, uint16_t count, int32_t duration_us)
+{
+  if (ring->filled == SUB_GATES_NUM)
+  {
+    ring->count_sum -= ring->counts[ring->index];
+    ring->duration_sum_us -= ring->durations_us[ring->index];
+  }
+  else
+  {
+    ring->filled++;
+  }
+  ring->counts[ring->index] = count;
+  ring->durations_us[ring->index] = duration_us;
+  ring->count_sum += count;
+  ring->duration_sum_us += duration_us;
+  ring->index = (ring->index + 1) % SUB_GATES_NUM;
+}
 
-  mgos_invoke_cb(clear_task_handle_on_exit, NULL, false);
+void frequency_count_gapless_task_function(void *pvParameter UNUSED_ARG)
+{
+  int16_t pcnt_value;
+  int16_t last_pcnt_value = 0;
 
-  vTaskDelete(NULL);
+  frequency_count_pcnt_init(PCNT_PIN_NOT_USED, pcnt_gapless_h_lim);
+  sub_gate_ring = (sub_gate_ring_t){0};
+
+  pcnt_counter_pause(pcnt_unit);
+  pcnt_counter_clear(pcnt_unit);
+  pcnt_counter_resume(pcnt_unit);
+  int64_t last_read_us = esp_timer_get_time();
+  TickType_t last_wake_time_ticks = xTaskGetTickCount();
+
+  while (true)
+  {
+    double frequency_hz;
+    vTaskDelayUntil(&last_wake_time_ticks, task_delay_ticks);
+
+    // never cleared, the edges between two reads go to the next sub-gate
+    pcnt_get_counter_value(pcnt_unit, &pcnt_value);
+    int64_t read_us = esp_timer_get_time();
+    int32_t pin_change_count = pcnt_value - last_pcnt_value;
+    if (pin_change_count < 0)
+      pin_change_count += pcnt_gapless_h_lim;
+    last_pcnt_value = pcnt_value;
+
+    sub_gate_add(&sub_gate_ring, pin_change_count, read_us - last_read_us);
+    last_read_us = read_us;
+
+    // we count both gpio swings thus we divide by 2
+    frequency_hz = sub_gate_ring.count_sum / 2.0 / (sub_gate_ring.duration_sum_us / 1000000.0);
+    LOG(LL_VERBOSE_DEBUG, ("%s, [FREQUENCY TASK] sub-gate %d, frequency %f", TAG, (int)pin_change_count, frequency_hz));
+
+    publish_counter_reading(sub_gate_ring.count_sum > UINT16_MAX ? UINT16_MAX : sub_gate_ring.count_sum, frequency_hz);
+
+    if (ulTaskNotifyTake(pdFALSE, 0) == terminate_task)
+      break;
+  }
+
+  LOG(LL_INFO, ("%s, [FREQUENCY TASK] stop task", TAG));
+
+  pcnt_counter_pause(pcnt_unit);
+  pcnt_counter_clear(pcnt_unit);
+
+  frequency_count_task_exit();
+}
+#endif
+
+#if FREQUENCY_PERIOD==1
+static IRAM_ATTR void period_edge_isr(int pin UNUSED_ARG, void *arg UNUSED_ARG)
+{
+  int64_t now_us = esp_timer_get_time();
+  portENTER_CRITICAL_ISR(&period_capture_mux);
+  if (now_us - period_capture.last_edge_us >= period_min_edge_us)
+  {
+    period_capture.edges++;
+    period_capture.last_edge_us = now_us;
+  }
+  portEXIT_CRITICAL_ISR(&period_capture_mux);
 }
 
+void frequency_count_period_task_function(void *pvParameter UNUSED_ARG)
+{
+  period_capture_t capture;
+  period_capture_t reference = {0};
+  // the first edge, or the first after a timeout, only starts a measurement
+  bool have_reference = false;
+  double frequency_hz = 0;
+  // rising edges of the last reads
+  uint32_t count_window[PERIOD_COUNT_READS] = {0};
+  uint8_t count_index = 0;
+  uint32_t count_sum = 0;
+
+  mgos_gpio_set_mode(pulse_gpio_pin, MGOS_GPIO_MODE_INPUT);
+  mgos_gpio_set_pull(pulse_gpio_pin, MGOS_GPIO_PULL_UP);
+  #if FREQUENCY_TEST_MODE==1
+    sensor_counter_test_init_gpio_output();
+  #endif
+
+  portENTER_CRITICAL(&period_capture_mux);
+  period_capture = (period_capture_t){0};
+  portEXIT_CRITICAL(&period_capture_mux);
+  mgos_gpio_set_int_handler_isr(pulse_gpio_pin, MGOS_GPIO_INT_EDGE_POS, period_edge_isr, NULL);
+  mgos_gpio_enable_int(pulse_gpio_pin);
+
+  TickType_t last_wake_time_ticks = xTaskGetTickCount();
+
+  while (true)
+  {
+    vTaskDelayUntil(&last_wake_time_ticks, task_delay_ticks);
+
+    portENTER_CRITICAL(&period_capture_mux);
+    capture = period_capture;
+    portEXIT_CRITICAL(&period_capture_mux);
+    int64_t now_us = esp_timer_get_time();
+    uint32_t new_edges = capture.edges - reference.edges;
+
+    if (new_edges > 0 && have_reference)
+    {
+      frequency_hz = new_edges * 1000000.0 / (capture.last_edge_us - reference.last_edge_us);
+    }
+    else if (new_edges == 0 && have_reference && now_us - reference.last_edge_us < period_timeout_us)
+    {
+      // the period in progress is already longer than this
+      double bound_hz = 1000000.0 / (now_us - reference.last_edge_us);
+      if (bound_hz < frequency_hz)
+        frequency_hz = bound_hz;
+    }
+    else if (new_edges == 0)
+    {
+      have_reference = false;
+      frequency_hz = 0;
+    }
+    if (new_edges > 0)
+    {
+      reference = capture;
+      have_reference = true;
+    }
+    LOG(LL_VERBOSE_DEBUG, ("%s, [FREQUENCY TASK] edges %u, frequency %f", TAG, (unsigned)new_edges, frequency_hz));
+
+    count_sum += new_edges - count_window[count_index];
+    count_window[count_index] = new_edges;
+    count_index = (count_index + 1) % PERIOD_COUNT_READS;
+    // both edges, like the PCNT counts
+    uint32_t count = 2 * count_sum;
+    publish_counter_reading(count > UINT16_MAX ? UINT16_MAX : count, frequency_hz);
+
+    if (ulTaskNotifyTake(pdFALSE, 0) == terminate_task)
+      break;
+  }
+
+  LOG(LL_INFO, ("%s, [FREQUENCY TASK] stop task", TAG));
+
+  mgos_gpio_disable_int(pulse_gpio_pin);
+  mgos_gpio_remove_int_handler(pulse_gpio_pin, NULL, NULL);
+
+  frequency_count_task_exit();
+}
+#endif
+
 bool sensor_counter_start()
 {
   if (frequency_task_handle != NULL)
     return false;
-  BaseType_t task_create_result = xTaskCreate(frequency_count_task_function, "frequency_count", 4096, NULL, MGOS_TASK_PRIORITY-1, &frequency_task_handle);
+#if FREQUENCY_GAPLESS==1
+  TaskFunction_t task_function = frequency_count_gapless_task_function;
+#elif FREQUENCY_PERIOD==1
+  TaskFunction_t task_function = frequency_count_period_task_function;
+#else
+  TaskFunction_t task_function = frequency_count_task_function;
+#endif
+  BaseType_t task_create_result = xTaskCreate(task_function, "frequency_count", 4096, NULL, MGOS_TASK_PRIORITY-1, &frequency_task_handle);
 
   if (task_create_result == errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY)
     return false;
@@ -264,6 +579,18 @@ bool sensor_counter_stop()
   return true;
 }
 
+uint32_t sensor_counter_overruns(void)
+{
+  return spsc_ring_overruns(&reading_ring);
+}
+
+void sensor_counter_set_alarm_threshold(int freq_thr_hz)
+{
+  // both edges are counted, taken at the start of the next window
+  int edges = freq_thr_hz * 2 * sampling_window_sec;
+  alarm_edges = edges > 0 && edges < 1000 ? edges : 0;
+}
+
 bool sensor_counter_init()
 {
 #ifndef MGOS_CONFIG_HAVE_BOARD_FREQUENCY_PIN
@@ -276,6 +603,9 @@ bool sensor_counter_init()
 
   LOG(LL_INFO, ("%s, [Counter pin] pin %d", TAG, pulse_gpio_pin));
 
+  spsc_ring_init(&reading_ring, reading_ring_items, sizeof(reading_ring_items[0]), READING_RING_SIZE);
+  spsc_ring_init(&alarm_ring, alarm_ring_items, sizeof(alarm_ring_items[0]), ALARM_RING_SIZE);
+
 #if FREQUENCY_TEST_MODE==1
   sensor_counter_test_init();
 #endif
@@ -6,14 +6,29 @@
 #define COUNTER_EVENT_BASE MGOS_EVENT_BASE('T', 'O', 'C')
 enum tank_overflow_event {
   COUNTER_BASE = COUNTER_EVENT_BASE,
-  COUNTER_CHANGE
+  COUNTER_CHANGE,
+  // raised as soon as the window holds enough pulses for an overflow
+  COUNTER_OVERFLOW_ALARM
 };
 
 typedef struct gpio_counter {
+  // rising and falling edges over the last 1s, in every mode
   uint16_t count;
-  uint16_t frequency;
+  float frequency;
+  // system timer in us at the end of the reading
+  int64_t timestamp_us;
 } gpio_counter_t;
 
+// system timer in us, esp_timer_get_time(), for the latency of the alarm
+typedef struct counter_alarm {
+  int64_t first_pulse_us;
+  int64_t alarm_us;
+} counter_alarm_t;
+
 bool sensor_counter_init();
+// readings dropped because the mgos task did not keep up
+uint32_t sensor_counter_overruns(void);
+// frequency threshold of the overflow alarm, 0 disables it
+void sensor_counter_set_alarm_threshold(int freq_thr_hz);
 bool sensor_counter_start();
 bool sensor_counter_stop();
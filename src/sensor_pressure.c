@@ -7,7 +7,16 @@
 #include "mgos_config_util.h"
 
 #include "sensor.h"
+#include "sensor_q16.h"
 #include "sensor_pressure.h"
+#include "adc_cal.h"
+#include "sensor_counter.h"
+#if PRESSURE_ADC_DMA==1
+#include "sensor_pressure_dma.h"
+#endif
+#if SENSING_TASK==1
+#include "mgos_freertos.h"
+#endif
 
 #define TAG "Pressure sensor"
 
@@ -15,24 +24,186 @@ static int pressure_adc_pin = -1;
 
 static mgos_timer_id adc_timer_id = MGOS_INVALID_TIMER_ID;
 static const int timer_period_ms = 50;
+
+#if PRESSURE_DECIMATION==1 && PRESSURE_FIXED_POINT==1
+#error "PRESSURE_DECIMATION runs on the double pipeline, disable PRESSURE_FIXED_POINT"
+#endif
+
+#if PRESSURE_KALMAN==1 && (PRESSURE_FIXED_POINT==1 || PRESSURE_DECIMATION==1)
+#error "PRESSURE_KALMAN replaces the average and EMA of the double pipeline, disable PRESSURE_FIXED_POINT and PRESSURE_DECIMATION"
+#endif
+
+#if SENSING_TASK==1 && PRESSURE_ADC_DMA==1
+#error "PRESSURE_ADC_DMA has its own task, disable SENSING_TASK"
+#endif
+
+#if SENSING_TASK==1
+// the sampling, filters and volume run on their own task on the APP CPU,
+// the network sends stay on the mgos task and do not delay a sample
+static TaskHandle_t sensing_task_handle = NULL;
+static const uint32_t sensing_task_stack = 6144;
+static const uint32_t terminate_task = 0x01;
+// held by the task for a sample, and by other tasks changing the pipeline
+static SemaphoreHandle_t sensing_mutex = NULL;
+#endif
+
+// continuous sampling needs a decimating pipeline
+#if PRESSURE_ADC_DMA==1 && PRESSURE_DECIMATION!=1
+#error "PRESSURE_ADC_DMA needs PRESSURE_DECIMATION=1"
+#endif
+
+#if PRESSURE_DECIMATION==1
+// a burst of ADC reads every timer tick, 1280 samples per second,
+// decimated to one value every 0.5 s
+#define ADC_BURST_SAMPLES 64
+static const uint16_t adc_decimation = 640;
+#if PRESSURE_ADC_DMA==1
+// continuous sampling keeps the same output period at its own rate
+static const uint32_t decimated_period_ms = 500;
+#endif
+#elif PRESSURE_KALMAN==1
+// one estimate every 10 samples, 0.5 s
+static const uint16_t kalman_output_every = 10;
+static double last_sample_s = 0;
+#else
 static const size_t number_of_adc_samples = 50;
+#endif
 
 static pressure_status_t pressure_status = {
-    .raw_adc = 0};
+    .raw_adc = 0,
+    .millivolts = 0};
 
-observable_value_t pressure_adc = {
+// samples enter the pipeline in calibrated millivolts with
+// PRESSURE_MILLIVOLTS=1 in mos.yml, in raw ADC codes otherwise
+#if PRESSURE_MILLIVOLTS==1
+#define PRESSURE_SAMPLE(raw) adc_cal_raw_to_mv(raw)
+#else
+#define PRESSURE_SAMPLE(raw) (raw)
+#endif
+
+// the status carries both units whichever the pipeline runs in
+// millivolts keep the resolution of the filtered value
+static void pressure_status_update(number_type value)
+{
+#if PRESSURE_MILLIVOLTS==1
+  pressure_status.millivolts = value;
+  pressure_status.raw_adc = adc_cal_mv_to_raw((int)value);
+#else
+  pressure_status.raw_adc = (int)value;
+  pressure_status.millivolts = adc_cal_raw_to_mv((int)value);
+#endif
+}
+
+// the pressure pipeline runs in Q16.16 fixed point when
+// PRESSURE_FIXED_POINT=1 is set in mos.yml, double otherwise
+#if PRESSURE_FIXED_POINT==1
+observable_q16_t pressure_adc = {
     .value.value = 0,
     .name = "pressure_adc",
     .filters = ((void *)0),
-    .observers = ((void *)0),
-    .set = set_value,
-    .process = process_new_value,
-    .notify = notify_observers,
+    .set = set_value_q16,
+    .process = process_new_value_q16,
+    .notify = notify_observers_q16,
 };
 
 // average
-filter_item_harmonic_average_t pressure_avg_filter = {
+filter_item_q16_average_t pressure_avg_filter = {
+    .super.filter = filter_item_q16_average_fn,
+    .number_of_samples = number_of_adc_samples,
+    .sample_counter_ = number_of_adc_samples,
+    .accumulator_ = 0,
+    .pass_first = false
+};
+
+// moving average
+filter_item_q16_exp_moving_average_t pressure_ma_filter = {
+    .super.filter = filter_item_q16_exp_moving_average_fn,
+    .initialized = false,
+    .previous_value = 0,
+    .alpha = Q16_FROM_FLOAT(0.8),
+    .pass_first = false
+};
+
+static void pressure_result_callback(observable_q16_t *this)
+{
+  LOG(LL_INFO, ("%s, Pressure result %d", TAG, Q16_TO_INT(this->value.value)));
+  pressure_status_update(Q16_TO_FLOAT(this->value.value));
+  mgos_event_trigger(PRESSURE_MEASUREMENT, &pressure_status);
+}
+
+static void pressure_measurement_callback(void *ud)
+{
+  int current_sample = mgos_adc_read(pressure_adc_pin);
+  LOG(LL_INFO, ("%s, Pressure adc value %d", TAG, current_sample));
+  pressure_adc.process(&pressure_adc, Q16_FROM_INT(PRESSURE_SAMPLE(current_sample)));
+}
+
+static void pressure_pipeline_init(void)
+{
+  add_filter_q16(&pressure_adc, (filter_item_q16_t *)&pressure_avg_filter);
+  add_filter_q16(&pressure_adc, (filter_item_q16_t *)&pressure_ma_filter);
+  add_observer_q16(&pressure_adc, pressure_result_callback);
+}
+#else
+#if PRESSURE_DECIMATION==1
+// a spike is averaged over order * decimation samples, no spike filter needed
+filter_item_cic_t pressure_cic_filter = {
+    .super.filter = filter_item_cic_fn,
+    .super.block_filter = filter_item_cic_block_fn,
+    .order = 3,
+    .decimation = adc_decimation,
+    .initialized = false
+};
+
+#define PRESSURE_CHAIN(STAGE) \
+  STAGE(cic, pressure_cic_filter)
+#elif PRESSURE_KALMAN==1
+filter_item_hampel_t pressure_spike_filter = {
+    .super.filter = filter_item_hampel_fn,
+    .super.block_filter = filter_item_hampel_block_fn,
+    .window_size = 9,
+    .threshold = 3,
+    .min_deviation = 20,
+    .replace = true,
+    .initialized = false,
+    .outliers = 0
+};
+
+// level and fill rate, tracks a fill without lag, the measurement noise
+// is the ADC noise, the process noise gives the step latency of the
+// average and EMA (bench step), during overflow the reading is mostly ignored
+filter_item_kalman_level_t pressure_kalman_filter = {
+    .super.filter = filter_item_kalman_level_fn,
+    .super.block_filter = filter_item_kalman_level_block_fn,
+    .dt = 0.05,
+    .process_noise = 0.002,
+    .measurement_noise = 25,
+    .overflow_noise_scale = 100,
+    .output_every = kalman_output_every,
+    .overflow = false,
+    .initialized = false
+};
+
+#define PRESSURE_CHAIN(STAGE)          \
+  STAGE(hampel, pressure_spike_filter) \
+  STAGE(kalman_level, pressure_kalman_filter)
+#else
+// drops single sample spikes, pump motor noise, before they reach the average
+filter_item_hampel_t pressure_spike_filter = {
+    .super.filter = filter_item_hampel_fn,
+    .super.block_filter = filter_item_hampel_block_fn,
+    .window_size = 9,
+    .threshold = 3,
+    .min_deviation = 20,
+    .replace = true,
+    .initialized = false,
+    .outliers = 0
+};
+
+// average
+filter_item_average_t pressure_avg_filter = {
     .super.filter = filter_item_average_fn,
+    .super.block_filter = filter_item_average_block_fn,
     .number_of_samples = number_of_adc_samples,
     .sample_counter_ = number_of_adc_samples,
     .accumulator_ = 0,
@@ -42,28 +213,140 @@ filter_item_harmonic_average_t pressure_avg_filter = {
 // moving average
 filter_item_exp_moving_average_t pressure_ma_filter = {
     .super.filter = filter_item_exp_moving_average_fn,
+    .super.block_filter = filter_item_exp_moving_average_block_fn,
     .initialized = false,
     .previous_value = 0,
     .alpha = 0.8,
     .pass_first = false
 };
 
+#define PRESSURE_CHAIN(STAGE)           \
+  STAGE(hampel, pressure_spike_filter)  \
+  STAGE(average, pressure_avg_filter)   \
+  STAGE(exp_moving_average, pressure_ma_filter)
+#endif
+
+FILTER_CHAIN(pressure_chain, PRESSURE_CHAIN)
+
+observable_value_t pressure_adc = {
+    .value.value = 0,
+    .name = "pressure_adc",
+    .chain = &pressure_chain,
+    .filters = ((void *)0),
+    .set = set_value,
+    .process = process_new_value,
+    .notify = notify_observers,
+};
+
 static void pressure_result_callback(observable_value_t *this)
 {
   LOG(LL_INFO, ("%s, Pressure result %d", TAG, (int)this->value.value));
-  pressure_status.raw_adc = (int)this->value.value;
+  pressure_status_update(this->value.value);
   mgos_event_trigger(PRESSURE_MEASUREMENT, &pressure_status);
 }
 
+#if PRESSURE_DECIMATION==1
+#if PRESSURE_ADC_DMA==1
+// blocks from the continuous ADC, runs on the mgos task
+static void pressure_block_callback(number_type *samples, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    samples[i] = PRESSURE_SAMPLE((int)samples[i]);
+  set_values(&pressure_adc, samples, n);
+}
+#endif
+
+static void pressure_measurement_callback(void *ud)
+{
+  number_type samples[ADC_BURST_SAMPLES];
+  for (size_t i = 0; i < ADC_BURST_SAMPLES; i++)
+    samples[i] = PRESSURE_SAMPLE(mgos_adc_read(pressure_adc_pin));
+  LOG(LL_DEBUG, ("%s, Pressure adc burst first value %d", TAG, (int)samples[0]));
+  process_new_values(&pressure_adc, samples, ADC_BURST_SAMPLES);
+}
+#else
 static void pressure_measurement_callback(void *ud)
 {
   int current_sample = mgos_adc_read(pressure_adc_pin);
   LOG(LL_INFO, ("%s, Pressure adc value %d", TAG, current_sample));
-  pressure_adc.process(&pressure_adc, current_sample);
+#if PRESSURE_KALMAN==1
+  // the timer period when the loop was late
+  double now_s = mgos_uptime();
+  if (last_sample_s > 0 && now_s > last_sample_s)
+    pressure_kalman_filter.dt = now_s - last_sample_s;
+  last_sample_s = now_s;
+#endif
+  pressure_adc.process(&pressure_adc, PRESSURE_SAMPLE(current_sample));
+}
+#endif
+
+#if PRESSURE_KALMAN==1
+// overflow pulses mean the reading carries dynamic pressure
+static void pressure_counter_cb(int ev, void *evd, void *user_data UNUSED_ARG)
+{
+  if (ev != COUNTER_CHANGE)
+    return;
+  gpio_counter_t *gpio_counter = evd;
+  int freq_thr_hz = mgos_sys_config_get_tank_frequency_high_threshold();
+  sensor_pressure_lock();
+  pressure_kalman_filter.overflow = freq_thr_hz > 0 && gpio_counter->frequency >= freq_thr_hz;
+  sensor_pressure_unlock();
+}
+#endif
+
+static void pressure_pipeline_init(void)
+{
+  add_observer(&pressure_adc, pressure_result_callback);
+#if PRESSURE_KALMAN==1
+  mgos_event_add_group_handler(COUNTER_EVENT_BASE, pressure_counter_cb, NULL);
+#endif
+}
+#endif
+
+void sensor_pressure_lock(void)
+{
+#if SENSING_TASK==1
+  if (sensing_mutex != NULL)
+    xSemaphoreTakeRecursive(sensing_mutex, portMAX_DELAY);
+#endif
 }
 
+void sensor_pressure_unlock(void)
+{
+#if SENSING_TASK==1
+  if (sensing_mutex != NULL)
+    xSemaphoreGiveRecursive(sensing_mutex);
+#endif
+}
+
+#if SENSING_TASK==1
+static void sensing_task_function(void *pvParameter UNUSED_ARG)
+{
+  TickType_t last_wake_time_ticks = xTaskGetTickCount();
+  while (true)
+  {
+    vTaskDelayUntil(&last_wake_time_ticks, pdMS_TO_TICKS(timer_period_ms));
+    sensor_pressure_lock();
+    pressure_measurement_callback(NULL);
+    sensor_pressure_unlock();
+    if (ulTaskNotifyTake(pdTRUE, 0) == terminate_task)
+      break;
+  }
+  LOG(LL_INFO, ("%s, stop sensing task", TAG));
+  sensing_task_handle = NULL;
+  vTaskDelete(NULL);
+}
+#endif
+
 bool pressure_sensor_stop()
 {
+#if PRESSURE_ADC_DMA==1
+  pressure_dma_stop();
+#endif
+#if SENSING_TASK==1
+  if (sensing_task_handle != NULL)
+    xTaskNotify(sensing_task_handle, terminate_task, eSetValueWithOverwrite);
+#endif
   if (adc_timer_id != 0)
     mgos_clear_timer(adc_timer_id);
   return true;
@@ -82,18 +365,50 @@ bool sensor_pressure_init()
 
   if (!mgos_adc_enable(pressure_adc_pin))
     return false;
+  if (!adc_cal_init())
+    return false;
 
   mgos_event_register_base(PRESSURE_EVENT_BASE, "Tank pressure events");
 
-  add_filter(&pressure_adc, (filter_item_t *)&pressure_avg_filter);
-  add_filter(&pressure_adc, (filter_item_t *)&pressure_ma_filter);
-  add_observer(&pressure_adc, pressure_result_callback);
+  pressure_pipeline_init();
+
+  // ADC1 belongs to I2S once continuous sampling starts
+  pressure_status_update(PRESSURE_SAMPLE(mgos_adc_read(pressure_adc_pin)));
+  return true;
+}
 
+// the first sample triggers the pressure events, with SENSING_TASK=1 on
+// the other CPU, so the handlers and the pipeline have to be in place
+bool sensor_pressure_start()
+{
+#if PRESSURE_ADC_DMA==1
+  uint32_t sample_rate_hz = mgos_sys_config_get_board_pressure_sample_rate();
+  if (sample_rate_hz < 1000 || sample_rate_hz > 100000)
+  {
+    LOG(LL_ERROR, ("%s, sample rate %u out of 1000..100000 Hz", TAG, (unsigned)sample_rate_hz));
+  }
+  else
+  {
+    pressure_cic_filter.decimation = sample_rate_hz * decimated_period_ms / 1000;
+    if (pressure_dma_start(pressure_adc_pin, sample_rate_hz, pressure_block_callback))
+      return true;
+  }
+  LOG(LL_ERROR, ("%s, continuous ADC failed, sampling on the timer", TAG));
+  pressure_cic_filter.decimation = adc_decimation;
+#endif
+
+#if SENSING_TASK==1
+  sensing_mutex = xSemaphoreCreateRecursiveMutex();
+  if (sensing_mutex == NULL)
+    return false;
+  if (xTaskCreatePinnedToCore(sensing_task_function, "sensing", sensing_task_stack, NULL, MGOS_TASK_PRIORITY,
+                              &sensing_task_handle, APP_CPU_NUM) != pdPASS)
+    return false;
+#else
   adc_timer_id = mgos_set_timer(timer_period_ms, MGOS_TIMER_REPEAT, pressure_measurement_callback, NULL);
   if (adc_timer_id == MGOS_INVALID_TIMER_ID)
     return false;
-
-  pressure_status.raw_adc = mgos_adc_read(pressure_adc_pin);
+#endif
 
   return true;
 }
@@ -12,6 +12,14 @@ enum pressure_event {
 
 typedef struct pressure_status {
   int raw_adc;
+  // calibrated, see adc_cal.h
+  float millivolts;
 } pressure_status_t;
 
-bool sensor_pressure_init();
\ No newline at end of file
+bool sensor_pressure_init();
+// starts sampling, call once the event handlers are registered
+bool sensor_pressure_start();
+// with SENSING_TASK=1 the pipeline runs on its own task, changes to it from
+// another task go between lock and unlock, no-ops otherwise
+void sensor_pressure_lock(void);
+void sensor_pressure_unlock(void);
\ No newline at end of file
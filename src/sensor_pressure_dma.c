@@ -0,0 +1,176 @@
+/**
+ * Continuous sampling of the pressure ADC with the I2S peripheral and DMA
+ * Reference:
+ * https://docs.espressif.com/projects/esp-idf/en/v4.3.5/esp32/api-reference/peripherals/i2s.html
+ *
+ * I2S0 drives ADC1 at the configured rate and fills the DMA buffers in the
+ * background. A task copies every buffer into a block of a small lock free
+ * ring and the mgos task drains the queued blocks through the pipeline, a
+ * block is free again once it has been processed.
+ */
+#if PRESSURE_ADC_DMA==1
+
+#include "mgos.h"
+#include "mgos_freertos.h"
+#include "driver/adc.h"
+#include "driver/i2s.h"
+
+#include "sensor_pressure_dma.h"
+#include "spsc_ring.h"
+
+#define TAG "Pressure DMA"
+
+static const i2s_port_t i2s_port = I2S_NUM_0;
+// DMA buffers of one block each, the driver keeps reading into the next
+// while a full one is copied out
+static const int dma_buffer_count = 4;
+// power of 2
+#define BLOCK_RING_SIZE 4
+
+typedef struct pressure_dma_block pressure_dma_block_t;
+struct pressure_dma_block
+{
+  number_type samples[PRESSURE_DMA_BLOCK_SAMPLES];
+  size_t n;
+};
+
+static pressure_dma_block_t block_ring_items[BLOCK_RING_SIZE];
+static spsc_ring_t block_ring;
+static pressure_dma_block_cb block_cb = NULL;
+
+static TaskHandle_t dma_task_handle = NULL;
+static const uint32_t terminate_task = 0x01;
+
+// ADC1 channels by GPIO, ADC2 can not be used with I2S
+static adc1_channel_t adc1_channel_from_pin(int pin)
+{
+  switch (pin)
+  {
+  case 36: return ADC1_CHANNEL_0;
+  case 37: return ADC1_CHANNEL_1;
+  case 38: return ADC1_CHANNEL_2;
+  case 39: return ADC1_CHANNEL_3;
+  case 32: return ADC1_CHANNEL_4;
+  case 33: return ADC1_CHANNEL_5;
+  case 34: return ADC1_CHANNEL_6;
+  case 35: return ADC1_CHANNEL_7;
+  default: return ADC1_CHANNEL_MAX;
+  }
+}
+
+static void process_block(void *item, void *user_data UNUSED_ARG)
+{
+  pressure_dma_block_t *block = item;
+  if (block_cb != NULL)
+    block_cb(block->samples, block->n);
+}
+
+static void process_blocks(void *arg UNUSED_ARG)
+{
+  spsc_ring_drain(&block_ring, process_block, NULL);
+}
+
+static void clear_task_handle_on_exit(void *arg UNUSED_ARG)
+{
+  dma_task_handle = NULL;
+}
+
+static void pressure_dma_task_function(void *pvParameter UNUSED_ARG)
+{
+  uint16_t raw[PRESSURE_DMA_BLOCK_SAMPLES];
+
+  i2s_adc_enable(i2s_port);
+  while (true)
+  {
+    size_t bytes_read = 0;
+    i2s_read(i2s_port, raw, sizeof(raw), &bytes_read, portMAX_DELAY);
+
+    // NULL if the pipeline is behind, this buffer is dropped
+    pressure_dma_block_t *block = spsc_ring_reserve(&block_ring);
+    if (block != NULL)
+    {
+      size_t n = bytes_read / sizeof(raw[0]);
+      // the upper 4 bits carry the channel number
+      for (size_t i = 0; i < n; i++)
+        block->samples[i] = raw[i] & 0x0FFF;
+      block->n = n;
+      spsc_ring_commit(&block_ring);
+    }
+    // a block not scheduled now goes with the next one
+    if (spsc_ring_request_drain(&block_ring) && !mgos_invoke_cb(process_blocks, NULL, false))
+      spsc_ring_cancel_drain(&block_ring);
+
+    if (ulTaskNotifyTake(pdFALSE, 0) == terminate_task)
+      break;
+  }
+  i2s_adc_disable(i2s_port);
+  i2s_driver_uninstall(i2s_port);
+
+  LOG(LL_INFO, ("%s, stop task, %u blocks dropped", TAG, (unsigned)spsc_ring_overruns(&block_ring)));
+  mgos_invoke_cb(clear_task_handle_on_exit, NULL, false);
+  vTaskDelete(NULL);
+}
+
+bool pressure_dma_start(int adc_pin, uint32_t sample_rate_hz, pressure_dma_block_cb cb)
+{
+  if (dma_task_handle != NULL)
+    return false;
+
+  adc1_channel_t channel = adc1_channel_from_pin(adc_pin);
+  if (channel == ADC1_CHANNEL_MAX)
+  {
+    LOG(LL_ERROR, ("%s, pin %d is not an ADC1 pin", TAG, adc_pin));
+    return false;
+  }
+
+  i2s_config_t i2s_config = {
+      .mode = I2S_MODE_MASTER | I2S_MODE_RX | I2S_MODE_ADC_BUILT_IN,
+      .sample_rate = sample_rate_hz,
+      .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
+      .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT,
+      .communication_format = I2S_COMM_FORMAT_STAND_I2S,
+      .intr_alloc_flags = 0,
+      .dma_buf_count = dma_buffer_count,
+      .dma_buf_len = PRESSURE_DMA_BLOCK_SAMPLES,
+      .use_apll = false,
+  };
+  if (i2s_driver_install(i2s_port, &i2s_config, 0, NULL) != ESP_OK)
+  {
+    LOG(LL_ERROR, ("%s, I2S driver install failed", TAG));
+    return false;
+  }
+  // attenuation and width stay as set up by mgos_adc_enable
+  if (i2s_set_adc_mode(ADC_UNIT_1, channel) != ESP_OK)
+  {
+    i2s_driver_uninstall(i2s_port);
+    return false;
+  }
+
+  spsc_ring_init(&block_ring, block_ring_items, sizeof(block_ring_items[0]), BLOCK_RING_SIZE);
+  block_cb = cb;
+
+  BaseType_t task_create_result = xTaskCreate(pressure_dma_task_function, "pressure_dma", 2048, NULL, MGOS_TASK_PRIORITY - 1, &dma_task_handle);
+  if (task_create_result == errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY)
+  {
+    i2s_driver_uninstall(i2s_port);
+    return false;
+  }
+
+  LOG(LL_INFO, ("%s, ADC1 channel %d at %u Hz", TAG, channel, (unsigned)sample_rate_hz));
+  return true;
+}
+
+bool pressure_dma_stop(void)
+{
+  if (dma_task_handle == NULL)
+    return false;
+  xTaskNotify(dma_task_handle, terminate_task, eSetValueWithOverwrite);
+  return true;
+}
+
+uint32_t pressure_dma_overruns(void)
+{
+  return spsc_ring_overruns(&block_ring);
+}
+
+#endif
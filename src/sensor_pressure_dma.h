@@ -0,0 +1,19 @@
+#pragma once
+
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+
+#include "sensor.h"
+
+// samples handed to the pipeline per block
+#define PRESSURE_DMA_BLOCK_SAMPLES 64
+
+// called on the mgos task with a block of raw ADC samples, the samples
+// may be changed by the filters and are not valid after the call
+typedef void (*pressure_dma_block_cb)(number_type *samples, size_t n);
+
+bool pressure_dma_start(int adc_pin, uint32_t sample_rate_hz, pressure_dma_block_cb cb);
+bool pressure_dma_stop(void);
+// blocks dropped because the mgos task did not keep up
+uint32_t pressure_dma_overruns(void);
@@ -0,0 +1,221 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "assert.h"
+
+#include "mgos.h"
+
+#include "sensor_q16.h"
+
+void add_filter_q16(observable_q16_t *ov, filter_item_q16_t *fi)
+{
+  filter_item_q16_t **current_filter = &ov->filters;
+
+  while ((*current_filter) != NULL)
+  {
+    current_filter = &(*current_filter)->next;
+  }
+
+  *current_filter = fi;
+}
+
+void remove_filter_q16(observable_q16_t *ov, filter_item_q16_t *fi)
+{
+  filter_item_q16_t **current_filter = &ov->filters;
+
+  while ((*current_filter) != NULL)
+  {
+    if (*current_filter == fi)
+    {
+      *current_filter = fi->next;
+      return;
+    }
+    current_filter = &(*current_filter)->next;
+  }
+}
+
+filter_ret_val_t filter_item_q16_clamp_fn(filter_item_q16_t *this, observable_number_q16_t *var)
+{
+  filter_item_q16_clamp_t *fi = (filter_item_q16_clamp_t *)this;
+  if (var->value < fi->min)
+    var->value = fi->min;
+  if (var->value > fi->max)
+    var->value = fi->max;
+  return FILTER_CONTINUE;
+}
+
+filter_ret_val_t filter_item_q16_offset_fn(filter_item_q16_t *this, observable_number_q16_t *var)
+{
+  filter_item_q16_offset_t *fi = (filter_item_q16_offset_t *)this;
+  var->value += fi->offset;
+  return FILTER_CONTINUE;
+}
+
+filter_ret_val_t filter_item_q16_skip_fn(filter_item_q16_t *this, observable_number_q16_t *var)
+{
+  filter_item_q16_skip_t *fi = (filter_item_q16_skip_t *)this;
+  if (fi->skip > 0)
+  {
+    fi->skip--;
+    return FILTER_STOP;
+  }
+  return FILTER_CONTINUE;
+}
+
+filter_ret_val_t filter_item_q16_exp_moving_average_fn(filter_item_q16_t *this, observable_number_q16_t *var)
+{
+  filter_item_q16_exp_moving_average_t *fi = (filter_item_q16_exp_moving_average_t *)this;
+  if (fi->initialized == false)
+  {
+    fi->previous_value = var->value;
+    fi->initialized = true;
+  }
+  if (fi->pass_first)
+  {
+    fi->pass_first = false;
+    return FILTER_CONTINUE;
+  }
+  var->value = fi->previous_value + q16_mul(fi->alpha, var->value - fi->previous_value);
+  fi->previous_value = var->value;
+
+  return FILTER_CONTINUE;
+}
+
+filter_ret_val_t filter_item_q16_average_fn(filter_item_q16_t *this, observable_number_q16_t *var)
+{
+  filter_item_q16_average_t *fi = (filter_item_q16_average_t *)this;
+  assert(fi->number_of_samples > 0);
+  fi->accumulator_ += var->value;
+  fi->sample_counter_--;
+  if (fi->sample_counter_ > 0)
+    return FILTER_STOP;
+
+  var->value = (q16_t)(fi->accumulator_ / (int64_t)fi->number_of_samples);
+  fi->accumulator_ = 0;
+  fi->sample_counter_ = fi->number_of_samples;
+
+  return FILTER_CONTINUE;
+}
+
+filter_ret_val_t filter_item_q16_harmonic_average_fn(filter_item_q16_t *this, observable_number_q16_t *var)
+{
+  filter_item_q16_harmonic_average_t *fi = (filter_item_q16_harmonic_average_t *)this;
+  assert(fi->number_of_samples > 0);
+  if (var->value <= 0)
+    return FILTER_INVALID_VALUE;
+  // 1/x in Q32.32
+  fi->accumulator_ += ((int64_t)1 << (32 + Q16_SHIFT)) / var->value;
+  fi->sample_counter_--;
+  if (fi->sample_counter_ > 0)
+    return FILTER_STOP;
+
+  var->value = (q16_t)(((int64_t)fi->number_of_samples << (32 + Q16_SHIFT)) / fi->accumulator_);
+  fi->accumulator_ = 0;
+  fi->sample_counter_ = fi->number_of_samples;
+
+  return FILTER_CONTINUE;
+}
+
+bool filter_q16_linear_fit_calc(filter_item_q16_linear_fit_t *this)
+{
+  if (this->value_map[0][0] == this->value_map[1][0])
+  {
+    return false;
+  }
+  this->slope_ = q16_div(this->value_map[0][1] - this->value_map[1][1], this->value_map[0][0] - this->value_map[1][0]);
+  this->intercept_ = this->value_map[0][1] - q16_mul(this->slope_, this->value_map[0][0]);
+  return true;
+}
+
+filter_ret_val_t filter_item_q16_linear_fit_fn(filter_item_q16_t *this, observable_number_q16_t *var)
+{
+  filter_item_q16_linear_fit_t *fi = (filter_item_q16_linear_fit_t *)this;
+  assert(fi->value_map[0][0] != fi->value_map[1][0]);
+  var->value = q16_mul(fi->slope_, var->value) + fi->intercept_;
+  return FILTER_CONTINUE;
+}
+
+// observer methods
+// same callback is allowed multiple times
+int add_observer_q16(observable_q16_t *ov, value_observer_q16_cb observer_cb)
+{
+  int slot;
+  for (slot = 0; slot < ov->observers_count; slot++)
+  {
+    if (ov->observers[slot].observer == NULL)
+      break;
+  }
+  if (slot == SENSOR_MAX_OBSERVERS)
+  {
+    LOG(LL_ERROR, ("%s, observer table full", ov->name));
+    return -1;
+  }
+  ov->observers[slot].observer = observer_cb;
+  if (slot == ov->observers_count)
+    ov->observers_count++;
+  return slot;
+}
+
+void remove_observer_q16_slot(observable_q16_t *ov, int slot)
+{
+  if (slot < 0 || slot >= ov->observers_count)
+    return;
+  ov->observers[slot].observer = NULL;
+  // drop empty slots at the end so notify does not walk them
+  while (ov->observers_count > 0 && ov->observers[ov->observers_count - 1].observer == NULL)
+    ov->observers_count--;
+}
+
+void remove_observer_q16(observable_q16_t *ov, value_observer_q16_cb observer_cb)
+{
+  for (int slot = 0; slot < ov->observers_count; slot++)
+  {
+    if (ov->observers[slot].observer == observer_cb)
+    {
+      remove_observer_q16_slot(ov, slot);
+      return;
+    }
+  }
+}
+
+void cleanup_observers_q16(observable_q16_t *ov)
+{
+  for (int slot = 0; slot < ov->observers_count; slot++)
+    ov->observers[slot].observer = NULL;
+  ov->observers_count = 0;
+}
+
+void notify_observers_q16(observable_q16_t *ov)
+{
+  for (int slot = 0; slot < ov->observers_count; slot++)
+  {
+    if (ov->observers[slot].observer != NULL)
+      ov->observers[slot].observer(ov);
+  }
+}
+
+// value methods
+void set_value_q16(observable_q16_t *ov, observable_number_q16_t new_value)
+{
+  filter_item_q16_t *current_filter = ov->filters;
+  while (current_filter != NULL)
+  {
+    if (current_filter->filter(current_filter, &new_value) != FILTER_CONTINUE)
+      return;
+    current_filter = current_filter->next;
+  }
+  ov->value = new_value;
+  ov->notify(ov);
+}
+
+void process_new_value_q16(observable_q16_t *ov, q16_t new_value)
+{
+  observable_number_q16_t value_ = {
+      .value = new_value};
+  ov->set(ov, value_);
+}
+
+void process_new_values_q16(observable_q16_t *ov, const q16_t *samples, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    ov->process(ov, samples[i]);
+}
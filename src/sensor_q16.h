@@ -0,0 +1,218 @@
+#pragma once
+
+// Q16.16 fixed point counterpart of the observable values and filters in sensor.h
+// ESP32 has no double precision FPU, this keeps the sample path in integer ops
+// range is +-32768 with a resolution of 1/65536, enough for ADC counts,
+// percentages and heights in cm
+
+#include "stdlib.h"
+#include "stdbool.h"
+#include "stdint.h"
+
+#include "sensor.h"
+
+typedef int32_t q16_t;
+
+#define Q16_SHIFT 16
+#define Q16_ONE ((q16_t)1 << Q16_SHIFT)
+
+#define Q16_FROM_INT(v) ((q16_t)(v) * Q16_ONE)
+#define Q16_FROM_FLOAT(v) ((q16_t)((v) * (float)Q16_ONE + ((v) >= 0 ? 0.5f : -0.5f)))
+#define Q16_TO_INT(v) ((int)((v) >> Q16_SHIFT))
+#define Q16_TO_FLOAT(v) ((float)(v) / (float)Q16_ONE)
+
+static inline q16_t q16_mul(q16_t a, q16_t b)
+{
+  return (q16_t)(((int64_t)a * b) >> Q16_SHIFT);
+}
+
+static inline q16_t q16_div(q16_t a, q16_t b)
+{
+  return (q16_t)(((int64_t)a << Q16_SHIFT) / b);
+}
+
+typedef struct observable_q16 observable_q16_t;
+
+typedef struct observable_number_q16 observable_number_q16_t;
+struct observable_number_q16
+{
+  q16_t value;
+};
+
+typedef struct filter_item_q16 filter_item_q16_t;
+typedef filter_ret_val_t (*value_filter_q16_fn)(filter_item_q16_t *, observable_number_q16_t *);
+struct filter_item_q16
+{
+  value_filter_q16_fn filter;
+  filter_item_q16_t *next;
+};
+
+void add_filter_q16(observable_q16_t *ov, filter_item_q16_t *fi);
+void remove_filter_q16(observable_q16_t *ov, filter_item_q16_t *fi);
+
+typedef struct filter_item_q16_exp_moving_average filter_item_q16_exp_moving_average_t;
+struct filter_item_q16_exp_moving_average
+{
+  filter_item_q16_t super;
+  bool initialized;
+  q16_t previous_value;
+  q16_t alpha;
+  bool pass_first;
+};
+
+typedef struct filter_item_q16_average filter_item_q16_average_t;
+struct filter_item_q16_average
+{
+  filter_item_q16_t super;
+  size_t number_of_samples;
+  size_t sample_counter_;
+  int64_t accumulator_;
+  bool pass_first;
+};
+
+typedef struct filter_item_q16_harmonic_average filter_item_q16_harmonic_average_t;
+struct filter_item_q16_harmonic_average
+{
+  filter_item_q16_t super;
+  size_t number_of_samples;
+  size_t sample_counter_;
+  // sum of reciprocals in Q32.32
+  int64_t accumulator_;
+  bool pass_first;
+};
+
+typedef struct filter_item_q16_linear_fit filter_item_q16_linear_fit_t;
+bool filter_q16_linear_fit_calc(filter_item_q16_linear_fit_t *);
+struct filter_item_q16_linear_fit
+{
+  filter_item_q16_t super;
+  q16_t value_map[2][2];
+  q16_t slope_;
+  q16_t intercept_;
+};
+
+typedef struct filter_item_q16_offset filter_item_q16_offset_t;
+struct filter_item_q16_offset
+{
+  filter_item_q16_t super;
+  q16_t offset;
+};
+
+typedef struct filter_item_q16_skip filter_item_q16_skip_t;
+struct filter_item_q16_skip
+{
+  filter_item_q16_t super;
+  uint16_t skip;
+};
+
+typedef struct filter_item_q16_clamp filter_item_q16_clamp_t;
+struct filter_item_q16_clamp
+{
+  filter_item_q16_t super;
+  q16_t min;
+  q16_t max;
+};
+
+filter_ret_val_t filter_item_q16_linear_fit_fn(filter_item_q16_t *this, observable_number_q16_t *var);
+filter_ret_val_t filter_item_q16_exp_moving_average_fn(filter_item_q16_t *this, observable_number_q16_t *var);
+filter_ret_val_t filter_item_q16_average_fn(filter_item_q16_t *this, observable_number_q16_t *var);
+filter_ret_val_t filter_item_q16_harmonic_average_fn(filter_item_q16_t *this, observable_number_q16_t *var);
+filter_ret_val_t filter_item_q16_clamp_fn(filter_item_q16_t *this, observable_number_q16_t *var);
+filter_ret_val_t filter_item_q16_offset_fn(filter_item_q16_t *this, observable_number_q16_t *var);
+filter_ret_val_t filter_item_q16_skip_fn(filter_item_q16_t *this, observable_number_q16_t *var);
+
+typedef void (*value_observer_q16_cb)(observable_q16_t *);
+
+typedef struct value_observer_q16_item value_observer_q16_item_t;
+struct value_observer_q16_item
+{
+  value_observer_q16_cb observer;
+};
+
+typedef void (*set_value_q16_fn)(observable_q16_t *, observable_number_q16_t);
+typedef void (*process_value_q16_fn)(observable_q16_t *, q16_t);
+typedef void (*notify_observers_q16_fn)(observable_q16_t *);
+
+// returns the observer slot, -1 when the table is full
+int add_observer_q16(observable_q16_t *ov, value_observer_q16_cb observer_cb);
+void remove_observer_q16(observable_q16_t *ov, value_observer_q16_cb observer_cb);
+void remove_observer_q16_slot(observable_q16_t *ov, int slot);
+void cleanup_observers_q16(observable_q16_t *ov);
+void notify_observers_q16(observable_q16_t *ov);
+void set_value_q16(observable_q16_t *ov, observable_number_q16_t new_value);
+void process_new_value_q16(observable_q16_t *ov, q16_t new_value);
+// integer kernels are cheap enough per call, blocks go sample by sample
+void process_new_values_q16(observable_q16_t *ov, const q16_t *samples, size_t n);
+
+struct observable_q16
+{
+  char name[20];
+  observable_number_q16_t value;
+  filter_item_q16_t *filters;
+  value_observer_q16_item_t observers[SENSOR_MAX_OBSERVERS];
+  // slots in use are below this mark, removed ones are left empty
+  uint8_t observers_count;
+  set_value_q16_fn set;
+  process_value_q16_fn process;
+  notify_observers_q16_fn notify;
+};
+
+#define OBSERVABLE_Q16(var_name, initial_value)                                      \
+  observable_q16_t var_name __attribute__((__cleanup__(cleanup_observers_q16))) = { \
+      .value.value = initial_value,                                                  \
+      .name = #var_name,                                                             \
+      .filters = NULL,                                                               \
+      .set = set_value_q16,                                                          \
+      .process = process_new_value_q16,                                              \
+      .notify = notify_observers_q16,                                                \
+  }
+
+#define FILTER_Q16(filter_name, type)                  \
+  filter_item_q16_##type##_t filter_name = {           \
+      .super.filter = filter_item_q16_##type##_fn,     \
+  }
+
+#define FILTER_Q16_CLAMP(filter_name, min_val, max_val) \
+  FILTER_Q16(filter_name, clamp);                       \
+  filter_name.min = Q16_FROM_FLOAT(min_val);            \
+  filter_name.max = Q16_FROM_FLOAT(max_val);
+
+#define FILTER_Q16_OFFSET(filter_name, offset_val) \
+  FILTER_Q16(filter_name, offset);                 \
+  filter_name.offset = Q16_FROM_FLOAT(offset_val);
+
+#define FILTER_Q16_SKIP(filter_name, skip_val) \
+  FILTER_Q16(filter_name, skip);               \
+  filter_name.skip = skip_val;
+
+#define FILTER_Q16_EXP_MOVING_AVERAGE(filter_name, alpha_val, pass_first_val) \
+  FILTER_Q16(filter_name, exp_moving_average);                                \
+  filter_name.initialized = false;                                            \
+  filter_name.previous_value = 0;                                             \
+  filter_name.alpha = Q16_FROM_FLOAT(alpha_val);                              \
+  filter_name.pass_first = pass_first_val;
+
+#define FILTER_Q16_AVERAGE(filter_name, number_of_samples_val, pass_first_val) \
+  FILTER_Q16(filter_name, average);                                            \
+  filter_name.number_of_samples = number_of_samples_val;                       \
+  filter_name.sample_counter_ = number_of_samples_val;                         \
+  filter_name.accumulator_ = 0;                                                \
+  filter_name.pass_first = pass_first_val;
+
+#define FILTER_Q16_HARMONIC_AVERAGE(filter_name, number_of_samples_val, pass_first_val) \
+  FILTER_Q16(filter_name, harmonic_average);                                            \
+  filter_name.number_of_samples = number_of_samples_val;                                \
+  filter_name.sample_counter_ = number_of_samples_val;                                  \
+  filter_name.accumulator_ = 0;                                                         \
+  filter_name.pass_first = pass_first_val;
+
+#define FILTER_Q16_LINEAR_FIT(filter_name, from_1, to_1, from_2, to_2) \
+  FILTER_Q16(filter_name, linear_fit);                                 \
+  filter_name.value_map[0][0] = Q16_FROM_FLOAT(from_1);                \
+  filter_name.value_map[0][1] = Q16_FROM_FLOAT(to_1);                  \
+  filter_name.value_map[1][0] = Q16_FROM_FLOAT(from_2);                \
+  filter_name.value_map[1][1] = Q16_FROM_FLOAT(to_2);                  \
+  filter_q16_linear_fit_calc(&filter_name);
+
+#define ADD_FILTER_Q16(var_name, filter) \
+  add_filter_q16(&var_name, (filter_item_q16_t *)&filter);
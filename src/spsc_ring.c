@@ -0,0 +1,85 @@
+#include "string.h"
+
+#include "spsc_ring.h"
+
+// the other side's index is read with acquire, the own index is published
+// with release, so an item is complete before its index is seen
+#define RING_LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define RING_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+bool spsc_ring_init(spsc_ring_t *ring, void *buffer, size_t item_size, uint32_t capacity)
+{
+  if (buffer == NULL || item_size == 0 || capacity == 0 || (capacity & (capacity - 1)) != 0)
+    return false;
+  ring->buffer = buffer;
+  ring->item_size = item_size;
+  ring->capacity = capacity;
+  ring->head = 0;
+  ring->tail = 0;
+  ring->overruns = 0;
+  ring->drain_pending = 0;
+  return true;
+}
+
+void *spsc_ring_reserve(spsc_ring_t *ring)
+{
+  uint32_t head = ring->head;
+  if (head - RING_LOAD(&ring->tail) == ring->capacity)
+  {
+    ring->overruns++;
+    return NULL;
+  }
+  return ring->buffer + (head & (ring->capacity - 1)) * ring->item_size;
+}
+
+void spsc_ring_commit(spsc_ring_t *ring)
+{
+  RING_STORE(&ring->head, ring->head + 1);
+}
+
+bool spsc_ring_push(spsc_ring_t *ring, const void *item)
+{
+  void *slot = spsc_ring_reserve(ring);
+  if (slot == NULL)
+    return false;
+  memcpy(slot, item, ring->item_size);
+  spsc_ring_commit(ring);
+  return true;
+}
+
+bool spsc_ring_request_drain(spsc_ring_t *ring)
+{
+  return __atomic_exchange_n(&ring->drain_pending, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+void spsc_ring_cancel_drain(spsc_ring_t *ring)
+{
+  RING_STORE(&ring->drain_pending, 0);
+}
+
+size_t spsc_ring_drain(spsc_ring_t *ring, spsc_ring_item_cb cb, void *user_data)
+{
+  // cleared first, an item pushed from now on schedules another drain.
+  // An RMW, so it reads from the producer's last request and acquires the
+  // head committed before it, a plain store would not
+  __atomic_exchange_n(&ring->drain_pending, 0, __ATOMIC_ACQ_REL);
+  uint32_t tail = ring->tail;
+  uint32_t head = RING_LOAD(&ring->head);
+  size_t n = head - tail;
+  for (; tail != head; tail++)
+  {
+    cb(ring->buffer + (tail & (ring->capacity - 1)) * ring->item_size, user_data);
+    RING_STORE(&ring->tail, tail + 1);
+  }
+  return n;
+}
+
+uint32_t spsc_ring_count(const spsc_ring_t *ring)
+{
+  return RING_LOAD(&ring->head) - RING_LOAD(&ring->tail);
+}
+
+uint32_t spsc_ring_overruns(const spsc_ring_t *ring)
+{
+  return RING_LOAD(&ring->overruns);
+}
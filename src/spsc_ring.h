@@ -0,0 +1,45 @@
+#pragma once
+
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+
+// lock free ring of fixed size items between one producer, a FreeRTOS
+// task, and one consumer, the mgos task. The producer only writes head,
+// the consumer only writes tail, both run freely and wrap, the capacity
+// is a power of 2. A full ring drops the new item and counts an overrun,
+// the queued items are never overwritten.
+typedef struct spsc_ring spsc_ring_t;
+struct spsc_ring
+{
+  uint8_t *buffer;
+  size_t item_size;
+  uint32_t capacity;
+  uint32_t head;
+  uint32_t tail;
+  uint32_t overruns;
+  // set by the producer when it schedules a drain, cleared by the drain
+  uint32_t drain_pending;
+};
+
+typedef void (*spsc_ring_item_cb)(void *item, void *user_data);
+
+// buffer holds capacity items of item_size
+bool spsc_ring_init(spsc_ring_t *ring, void *buffer, size_t item_size, uint32_t capacity);
+
+// producer, copies the item in
+bool spsc_ring_push(spsc_ring_t *ring, const void *item);
+// producer, fill the returned slot in place then commit it, NULL if full
+void *spsc_ring_reserve(spsc_ring_t *ring);
+void spsc_ring_commit(spsc_ring_t *ring);
+// producer, true if the caller has to schedule a drain, at most one is
+// pending, cancel if it could not be scheduled
+bool spsc_ring_request_drain(spsc_ring_t *ring);
+void spsc_ring_cancel_drain(spsc_ring_t *ring);
+
+// consumer, calls cb for each queued item, the item is released after
+// the call, returns the number of items
+size_t spsc_ring_drain(spsc_ring_t *ring, spsc_ring_item_cb cb, void *user_data);
+
+uint32_t spsc_ring_count(const spsc_ring_t *ring);
+uint32_t spsc_ring_overruns(const spsc_ring_t *ring);
@@ -0,0 +1,242 @@
+#include "math.h"
+#include "stdio.h"
+
+#include "mgos.h"
+#include "mgos_system.h"
+#include "mgos_sys_config.h"
+#include "frozen.h"
+
+#include "sensor_pressure.h"
+#include "sensor_counter.h"
+#include "tank_volume.h"
+#include "tank_autocal.h"
+
+#define TAG "Tank autocal"
+
+// weight of a new observation is 1 / (samples + 2), at least 1 / AUTOCAL_MAX_WEIGHT
+// the configured threshold counts as a first sample
+#define AUTOCAL_MAX_WEIGHT 8
+// outliers are rejected once the spread is known
+#define AUTOCAL_MIN_SAMPLES 3
+// learned values are used from this confidence on
+static const float autocal_min_confidence = 0.5;
+// flash writes, a change of at least save_delta and one write per save_interval
+static const float autocal_save_delta = 1.0;
+static const double autocal_save_interval_s = 6 * 3600;
+
+static tank_anchor_t low_anchor;
+static tank_anchor_t high_anchor;
+static uint16_t fill_cycles = 0;
+static uint16_t rejected = 0;
+static uint16_t writes = 0;
+
+static bool enabled = false;
+static bool overflow_ = false;
+// lowest level since the last overflow, the cycle before the first
+// overflow after boot starts with the filters settling and is not used
+static bool cycle_started_ = false;
+static float cycle_min_ = 0;
+static bool cycle_min_valid_ = false;
+
+static float saved_low = NAN, saved_high = NAN;
+static double saved_at_s = 0;
+
+static float anchor_weight(const tank_anchor_t *anchor)
+{
+  uint16_t n = anchor->samples + 2;
+  return 1.0f / (n < AUTOCAL_MAX_WEIGHT ? n : AUTOCAL_MAX_WEIGHT);
+}
+
+// exponentially weighted mean and variance
+static void anchor_update(tank_anchor_t *anchor, float observation)
+{
+  float weight = anchor_weight(anchor);
+  float delta = observation - anchor->value;
+  anchor->value += weight * delta;
+  anchor->variance = (1 - weight) * (anchor->variance + weight * delta * delta);
+  if (anchor->samples < UINT16_MAX)
+    anchor->samples++;
+}
+
+// a spread of 2% of the span or 2 counts is tolerated
+static float anchor_tolerance(void)
+{
+  float tolerance = 0.02f * (high_anchor.value - low_anchor.value);
+  return tolerance > 2 ? tolerance : 2;
+}
+
+float tank_autocal_confidence(void)
+{
+  float count = high_anchor.samples < AUTOCAL_MAX_WEIGHT ? high_anchor.samples : AUTOCAL_MAX_WEIGHT;
+  float spread = high_anchor.variance / (anchor_tolerance() * anchor_tolerance());
+  return count / AUTOCAL_MAX_WEIGHT / (1 + spread);
+}
+
+static bool autocal_load(const char *path)
+{
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+    return false;
+  tank_anchor_t low, high;
+  unsigned low_samples, high_samples;
+  int n = fscanf(file, "%f,%f,%u,%f,%f,%u", &low.value, &low.variance, &low_samples,
+                 &high.value, &high.variance, &high_samples);
+  fclose(file);
+  if (n != 6 || low.value >= high.value)
+  {
+    LOG(LL_ERROR, ("%s, bad state in %s", TAG, path));
+    return false;
+  }
+  low.samples = low_samples;
+  high.samples = high_samples;
+  low_anchor = low;
+  high_anchor = high;
+  saved_low = low.value;
+  saved_high = high.value;
+  return true;
+}
+
+// bounded writes, the flash sees at most one write per save interval
+static void autocal_save(void)
+{
+  double now_s = mgos_uptime();
+  if (fabsf(low_anchor.value - saved_low) < autocal_save_delta && fabsf(high_anchor.value - saved_high) < autocal_save_delta)
+    return;
+  if (writes > 0 && now_s - saved_at_s < autocal_save_interval_s)
+    return;
+
+  FILE *file = fopen(mgos_sys_config_get_tank_autocal_file(), "w");
+  if (file == NULL)
+    return;
+  fprintf(file, "%.2f,%.2f,%u,%.2f,%.2f,%u\n", low_anchor.value, low_anchor.variance, (unsigned)low_anchor.samples,
+          high_anchor.value, high_anchor.variance, (unsigned)high_anchor.samples);
+  if (fclose(file) != 0)
+    return;
+  saved_low = low_anchor.value;
+  saved_high = high_anchor.value;
+  saved_at_s = now_s;
+  writes++;
+}
+
+static void autocal_apply(void)
+{
+  if (tank_autocal_confidence() < autocal_min_confidence)
+    return;
+  tank_volume_set_threshold(low_anchor.value, high_anchor.value);
+}
+
+// the pressure at the start of an overflow is the full tank
+static void autocal_observe_full(float pressure, float cycle_min, bool cycle_min_valid)
+{
+  fill_cycles++;
+  // overflow pulses with the tank below half are not from a fill
+  if (pressure < (low_anchor.value + high_anchor.value) / 2)
+  {
+    rejected++;
+    return;
+  }
+  float delta = pressure - high_anchor.value;
+  if (high_anchor.samples >= AUTOCAL_MIN_SAMPLES &&
+      fabsf(delta) > 4 * sqrtf(high_anchor.variance) + anchor_tolerance())
+  {
+    rejected++;
+    LOG(LL_INFO, ("%s, full tank at %.1f rejected, expected %.1f", TAG, pressure, high_anchor.value));
+    return;
+  }
+  float previous_high = high_anchor.value;
+  anchor_update(&high_anchor, pressure);
+  // the same offset drift moves the empty anchor
+  low_anchor.value += high_anchor.value - previous_high;
+
+  // the tank went below the empty anchor during the cycle
+  if (cycle_min_valid && cycle_min < low_anchor.value)
+    anchor_update(&low_anchor, cycle_min);
+
+  LOG(LL_INFO, ("%s, anchors %.1f %.1f, confidence %.2f", TAG, low_anchor.value, high_anchor.value, tank_autocal_confidence()));
+  autocal_apply();
+  autocal_save();
+}
+
+static void autocal_pressure_cb(int ev, void *evd UNUSED_ARG, void *user_data UNUSED_ARG)
+{
+  if (ev != PRESSURE_MEASUREMENT)
+    return;
+  float pressure;
+  if (!cycle_started_ || !tank_volume_compensated_pressure(&pressure))
+    return;
+  if (!cycle_min_valid_ || pressure < cycle_min_)
+    cycle_min_ = pressure;
+  cycle_min_valid_ = true;
+}
+
+static void autocal_counter_cb(int ev, void *evd, void *user_data UNUSED_ARG)
+{
+  if (ev != COUNTER_CHANGE)
+    return;
+  gpio_counter_t *gpio_counter = evd;
+  int freq_thr_hz = mgos_sys_config_get_tank_frequency_high_threshold();
+  bool overflow = freq_thr_hz > 0 && gpio_counter->frequency >= freq_thr_hz;
+  float pressure;
+  // the cycle minimum is kept by the sample, on the sensing task with
+  // SENSING_TASK=1, the anchors are only updated here
+  sensor_pressure_lock();
+  bool full = overflow && !overflow_ && tank_volume_compensated_pressure(&pressure);
+  float cycle_min = cycle_min_;
+  bool cycle_min_valid = cycle_min_valid_;
+  if (full)
+  {
+    // the next cycle starts at the overflow
+    cycle_started_ = true;
+    cycle_min_valid_ = false;
+  }
+  sensor_pressure_unlock();
+  overflow_ = overflow;
+  if (full)
+    autocal_observe_full(pressure, cycle_min, cycle_min_valid);
+}
+
+void tank_autocal_reset(float low_threshold, float high_threshold)
+{
+  low_anchor = (tank_anchor_t){.value = low_threshold, .variance = 0, .samples = 0};
+  high_anchor = (tank_anchor_t){.value = high_threshold, .variance = 0, .samples = 0};
+  fill_cycles = 0;
+  rejected = 0;
+  saved_low = saved_high = NAN;
+  if (enabled)
+    remove(mgos_sys_config_get_tank_autocal_file());
+}
+
+bool tank_autocal_init(float low_threshold, float high_threshold)
+{
+  enabled = mgos_sys_config_get_tank_autocal_enable();
+  low_anchor = (tank_anchor_t){.value = low_threshold, .variance = 0, .samples = 0};
+  high_anchor = (tank_anchor_t){.value = high_threshold, .variance = 0, .samples = 0};
+  if (!enabled)
+    return true;
+
+  if (autocal_load(mgos_sys_config_get_tank_autocal_file()))
+  {
+    LOG(LL_INFO, ("%s, restored anchors %.1f %.1f, confidence %.2f", TAG, low_anchor.value, high_anchor.value, tank_autocal_confidence()));
+    autocal_apply();
+  }
+  mgos_event_add_group_handler(PRESSURE_EVENT_BASE, autocal_pressure_cb, NULL);
+  mgos_event_add_group_handler(COUNTER_EVENT_BASE, autocal_counter_cb, NULL);
+  return true;
+}
+
+static int anchor_to_json(struct json_out *out, const tank_anchor_t *anchor)
+{
+  return json_printf(out, "{value:%.2f, stddev:%.2f, samples:%u}", anchor->value, sqrtf(anchor->variance), (unsigned)anchor->samples);
+}
+
+int tank_autocal_to_json(struct json_out *out)
+{
+  float confidence = tank_autocal_confidence();
+  int len = json_printf(out, "{enabled:%B, applied:%B, confidence:%.2f, low:", enabled,
+                        enabled && confidence >= autocal_min_confidence, confidence);
+  len += anchor_to_json(out, &low_anchor);
+  len += json_printf(out, ", high:");
+  len += anchor_to_json(out, &high_anchor);
+  len += json_printf(out, ", fill_cycles:%u, rejected:%u, writes:%u}", (unsigned)fill_cycles, (unsigned)rejected, (unsigned)writes);
+  return len;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "stdbool.h"
+#include "stdint.h"
+
+struct json_out;
+
+// learns the compensated pressure of the empty and the full tank
+// a fill cycle ends with overflow pulses on the flow counter, the pressure
+// at that moment is an observation of the full anchor. A shift of the full
+// anchor is applied to the empty anchor as well, sensor offset drift, and
+// the empty anchor also follows the lowest level seen between two fills
+// when it is below it
+
+typedef struct tank_anchor tank_anchor_t;
+struct tank_anchor
+{
+  float value;
+  float variance;
+  uint16_t samples;
+};
+
+// starts from the configured thresholds or from the saved state
+bool tank_autocal_init(float low_threshold, float high_threshold);
+// thresholds set by hand restart the learning from them
+void tank_autocal_reset(float low_threshold, float high_threshold);
+// 0..1 from the number of observations and their spread
+float tank_autocal_confidence(void);
+int tank_autocal_to_json(struct json_out *out);
@@ -0,0 +1,146 @@
+#include "math.h"
+
+#include "mgos.h"
+#include "mgos_system.h"
+#include "mgos_sys_config.h"
+#include "frozen.h"
+
+#include "sensor.h"
+#include "sensor_counter.h"
+#include "sensor_pressure.h"
+#include "tank_drift.h"
+
+#define TAG "Tank drift"
+
+// the level is checked once per window, a static window is one model update
+static const double drift_window_s = 60;
+// about a day and a half of windows to forget an old fit
+static const float drift_lambda = 0.9995;
+// prior variance of the coefficients, in pressure units per degree or per hPa
+static const float drift_delta = 1.0;
+// ambient pressure regressor around the standard atmosphere
+static const float drift_air_pressure_ref = 1013.25;
+
+enum drift_regressor
+{
+  DRIFT_TEMPERATURE = 0,
+  DRIFT_AIR_PRESSURE,
+};
+
+static bool enabled = false;
+static float static_tolerance_ = 0;
+static sensor_rls_t drift_rls;
+
+// current window
+static double window_start_s = 0;
+static float window_start_pressure = 0;
+static bool window_started_ = false;
+static bool window_pulses_ = false;
+
+// start of the static period, the model sees changes against it
+static bool period_active_ = false;
+static float period_pressure = 0;
+static float period_temperature = 0;
+static float period_air_pressure = 0;
+
+static uint32_t static_windows = 0;
+static uint32_t periods = 0;
+static float last_error = 0;
+
+static void drift_regressors(float *x, float temperature, float air_pressure)
+{
+  x[DRIFT_TEMPERATURE] = temperature;
+  if (drift_rls.k > DRIFT_AIR_PRESSURE)
+    x[DRIFT_AIR_PRESSURE] = air_pressure;
+}
+
+static void drift_window_end(float pressure, float temperature, float air_pressure)
+{
+  bool level_static = !window_pulses_ && fabsf(pressure - window_start_pressure) <= static_tolerance_;
+  if (!level_static)
+  {
+    period_active_ = false;
+    return;
+  }
+  static_windows++;
+  if (!period_active_)
+  {
+    period_active_ = true;
+    period_pressure = pressure;
+    period_temperature = temperature;
+    period_air_pressure = air_pressure;
+    periods++;
+    return;
+  }
+  float x[SENSOR_RLS_MAX_K];
+  drift_regressors(x, temperature - period_temperature, air_pressure - period_air_pressure);
+  last_error = sensor_rls_update(&drift_rls, x, pressure - period_pressure);
+}
+
+float tank_drift_offset(float pressure, float temperature, float air_pressure)
+{
+  double now_s = mgos_uptime();
+  if (!window_started_)
+  {
+    window_started_ = true;
+    window_start_s = now_s;
+    window_start_pressure = pressure;
+    window_pulses_ = false;
+  }
+  else if (now_s - window_start_s >= drift_window_s)
+  {
+    drift_window_end(pressure, temperature, air_pressure);
+    window_start_s = now_s;
+    window_start_pressure = pressure;
+    window_pulses_ = false;
+  }
+
+  float x[SENSOR_RLS_MAX_K];
+  drift_regressors(x, temperature, air_pressure - drift_air_pressure_ref);
+  return sensor_rls_predict(&drift_rls, x);
+}
+
+static void drift_counter_cb(int ev, void *evd, void *user_data UNUSED_ARG)
+{
+  if (ev != COUNTER_CHANGE)
+    return;
+  gpio_counter_t *gpio_counter = evd;
+  // the window runs with the sample, on the sensing task with SENSING_TASK=1
+  sensor_pressure_lock();
+  if (gpio_counter->count > 0)
+    window_pulses_ = true;
+  sensor_pressure_unlock();
+}
+
+bool tank_drift_enabled(void)
+{
+  return enabled;
+}
+
+bool tank_drift_init(float temperature_coeff, float static_tolerance)
+{
+  enabled = mgos_sys_config_get_tank_drift_enable();
+  static_tolerance_ = static_tolerance;
+  // starts from the constant coefficient, no ambient pressure dependency
+  float prior[SENSOR_RLS_MAX_K] = {[DRIFT_TEMPERATURE] = temperature_coeff};
+  uint8_t k = mgos_sys_config_get_tank_drift_air_pressure() ? 2 : 1;
+  sensor_rls_init(&drift_rls, k, drift_lambda, drift_delta, prior);
+  if (!enabled)
+    return true;
+  mgos_event_add_group_handler(COUNTER_EVENT_BASE, drift_counter_cb, NULL);
+  return true;
+}
+
+int tank_drift_to_json(struct json_out *out)
+{
+  sensor_pressure_lock();
+  int len = json_printf(out, "{enabled:%B, temperature_coeff:%.4f, temperature_uncertainty:%.4f", enabled,
+                        drift_rls.theta[DRIFT_TEMPERATURE], sqrtf(drift_rls.p[DRIFT_TEMPERATURE][DRIFT_TEMPERATURE]));
+  if (drift_rls.k > DRIFT_AIR_PRESSURE)
+    len += json_printf(out, ", air_pressure_coeff:%.4f, air_pressure_uncertainty:%.4f", drift_rls.theta[DRIFT_AIR_PRESSURE],
+                       sqrtf(drift_rls.p[DRIFT_AIR_PRESSURE][DRIFT_AIR_PRESSURE]));
+  len += json_printf(out, ", updates:%u, static_windows:%u, periods:%u, last_error:%.2f}", (unsigned)drift_rls.updates,
+                     (unsigned)static_windows, (unsigned)periods, last_error);
+  sensor_pressure_unlock();
+  return len;
+}
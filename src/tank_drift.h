@@ -0,0 +1,16 @@
+#pragma once
+
+#include "stdbool.h"
+
+struct json_out;
+
+// pressure sensor offset against air temperature, and optionally ambient
+// air pressure, fitted with recursive least squares while the water level
+// is static: no flow pulses and the reading steady over a window. Within
+// a static period every change of the reading is drift, the model fits the
+// change since the start of the period to the change of the environment
+bool tank_drift_init(float temperature_coeff, float static_tolerance);
+bool tank_drift_enabled(void);
+// offset to subtract from a pressure reading, the reading feeds the model
+float tank_drift_offset(float pressure, float temperature, float air_pressure);
+int tank_drift_to_json(struct json_out *out);
@@ -0,0 +1,248 @@
+#include "math.h"
+#include "stdio.h"
+#include "string.h"
+
+#include "mgos.h"
+#include "mgos_sys_config.h"
+
+#include "tank_geometry.h"
+
+#define TAG "Tank geometry"
+
+// the first tank, a 50 cm cylinder 100 cm long lying on its side
+static const tank_geometry_t default_geometry = {
+    .shape = TANK_SHAPE_HORIZONTAL_CYLINDER,
+    .diameter_cm = 50,
+    .length_cm = 100,
+    .width_cm = 0,
+    .height_cm = 0};
+
+static const char *shape_names[] = {
+    [TANK_SHAPE_HORIZONTAL_CYLINDER] = "horizontal_cylinder",
+    [TANK_SHAPE_VERTICAL_CYLINDER] = "vertical_cylinder",
+    [TANK_SHAPE_RECTANGULAR] = "rectangular",
+    [TANK_SHAPE_CAPSULE] = "capsule",
+    [TANK_SHAPE_STRAPPING] = "strapping",
+};
+
+static float volume_table[TANK_GEOMETRY_INTERVALS + 1];
+static float max_height_cm = 0;
+// table entries per cm
+static float table_scale = 0;
+
+tank_shape_t tank_shape_from_name(const char *name)
+{
+  for (int shape = 0; shape < TANK_SHAPE_INVALID; shape++)
+  {
+    if (name != NULL && strcmp(name, shape_names[shape]) == 0)
+      return shape;
+  }
+  return TANK_SHAPE_INVALID;
+}
+
+const char *tank_shape_name(tank_shape_t shape)
+{
+  return shape < TANK_SHAPE_INVALID ? shape_names[shape] : "invalid";
+}
+
+// area of the circular segment filled up to height_cm
+static double circle_segment_cm2(double radius_cm, double height_cm)
+{
+  return radius_cm * radius_cm * acos(1 - height_cm / radius_cm) -
+         (radius_cm - height_cm) * sqrt(2 * radius_cm * height_cm - height_cm * height_cm);
+}
+
+static float geometry_height_cm(const tank_geometry_t *geometry)
+{
+  switch (geometry->shape)
+  {
+  case TANK_SHAPE_HORIZONTAL_CYLINDER:
+  case TANK_SHAPE_CAPSULE:
+    return geometry->diameter_cm;
+  case TANK_SHAPE_VERTICAL_CYLINDER:
+  case TANK_SHAPE_RECTANGULAR:
+    return geometry->height_cm;
+  default:
+    return 0;
+  }
+}
+
+float tank_geometry_exact_liters(const tank_geometry_t *geometry, float height_cm)
+{
+  double h = height_cm;
+  double r = geometry->diameter_cm / 2.0;
+  double cm3 = 0;
+
+  if (h < 0)
+    h = 0;
+  if (h > geometry_height_cm(geometry))
+    h = geometry_height_cm(geometry);
+
+  switch (geometry->shape)
+  {
+  case TANK_SHAPE_HORIZONTAL_CYLINDER:
+    cm3 = geometry->length_cm * circle_segment_cm2(r, h);
+    break;
+  case TANK_SHAPE_CAPSULE:
+    // the two ends make a sphere, a spherical cap of height h
+    cm3 = geometry->length_cm * circle_segment_cm2(r, h) + M_PI * h * h * (3 * r - h) / 3.0;
+    break;
+  case TANK_SHAPE_VERTICAL_CYLINDER:
+    cm3 = M_PI * r * r * h;
+    break;
+  case TANK_SHAPE_RECTANGULAR:
+    cm3 = geometry->length_cm * geometry->width_cm * h;
+    break;
+  default:
+    break;
+  }
+  return cm3 / 1000.0;
+}
+
+static bool geometry_valid(const tank_geometry_t *geometry)
+{
+  switch (geometry->shape)
+  {
+  case TANK_SHAPE_HORIZONTAL_CYLINDER:
+  case TANK_SHAPE_CAPSULE:
+    return geometry->diameter_cm > 0 && geometry->length_cm >= 0;
+  case TANK_SHAPE_VERTICAL_CYLINDER:
+    return geometry->diameter_cm > 0 && geometry->height_cm > 0;
+  case TANK_SHAPE_RECTANGULAR:
+    return geometry->length_cm > 0 && geometry->width_cm > 0 && geometry->height_cm > 0;
+  default:
+    return false;
+  }
+}
+
+bool tank_geometry_init(const tank_geometry_t *geometry)
+{
+  if (!geometry_valid(geometry))
+  {
+    LOG(LL_ERROR, ("%s, invalid dimensions for %s", TAG, tank_shape_name(geometry->shape)));
+    return false;
+  }
+  max_height_cm = geometry_height_cm(geometry);
+  table_scale = TANK_GEOMETRY_INTERVALS / max_height_cm;
+  for (int i = 0; i <= TANK_GEOMETRY_INTERVALS; i++)
+    volume_table[i] = tank_geometry_exact_liters(geometry, i / table_scale);
+
+  LOG(LL_INFO, ("%s, %s %.1f cm high, %.1f liters", TAG, tank_shape_name(geometry->shape),
+                max_height_cm, volume_table[TANK_GEOMETRY_INTERVALS]));
+  return true;
+}
+
+bool tank_geometry_load_strapping(const char *path)
+{
+  float heights[TANK_STRAPPING_MAX_POINTS];
+  float liters[TANK_STRAPPING_MAX_POINTS];
+  int points = 0;
+  char line[64];
+  bool ok = true;
+
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+  {
+    LOG(LL_ERROR, ("%s, can not open strapping table %s", TAG, path));
+    return false;
+  }
+  while (ok && fgets(line, sizeof(line), file) != NULL)
+  {
+    float height, volume;
+    if (line[0] == '#' || line[0] == '\r' || line[0] == '\n')
+      continue;
+    if (sscanf(line, "%f,%f", &height, &volume) != 2)
+    {
+      LOG(LL_ERROR, ("%s, bad line in %s: %s", TAG, path, line));
+      ok = false;
+    }
+    else if (points == TANK_STRAPPING_MAX_POINTS)
+    {
+      LOG(LL_ERROR, ("%s, more than %d points in %s", TAG, TANK_STRAPPING_MAX_POINTS, path));
+      ok = false;
+    }
+    else if (points > 0 && (height <= heights[points - 1] || volume < liters[points - 1]))
+    {
+      LOG(LL_ERROR, ("%s, heights must increase and volumes must not decrease in %s", TAG, path));
+      ok = false;
+    }
+    else
+    {
+      heights[points] = height;
+      liters[points] = volume;
+      points++;
+    }
+  }
+  fclose(file);
+  if (!ok)
+    return false;
+  if (points < 2 || heights[0] != 0)
+  {
+    LOG(LL_ERROR, ("%s, %s needs at least 2 points starting at height 0", TAG, path));
+    return false;
+  }
+
+  // resample the points at the table heights
+  max_height_cm = heights[points - 1];
+  table_scale = TANK_GEOMETRY_INTERVALS / max_height_cm;
+  int point = 0;
+  for (int i = 0; i <= TANK_GEOMETRY_INTERVALS; i++)
+  {
+    float height = i / table_scale;
+    while (point < points - 2 && height > heights[point + 1])
+      point++;
+    float fraction = (height - heights[point]) / (heights[point + 1] - heights[point]);
+    if (fraction > 1)
+      fraction = 1;
+    volume_table[i] = liters[point] + fraction * (liters[point + 1] - liters[point]);
+  }
+
+  LOG(LL_INFO, ("%s, strapping table %s, %d points, %.1f cm high, %.1f liters", TAG, path, points,
+                max_height_cm, volume_table[TANK_GEOMETRY_INTERVALS]));
+  return true;
+}
+
+bool tank_geometry_init_from_config(void)
+{
+  tank_geometry_t geometry = {
+      .shape = tank_shape_from_name(mgos_sys_config_get_tank_geometry_shape()),
+      .diameter_cm = mgos_sys_config_get_tank_geometry_diameter_cm(),
+      .length_cm = mgos_sys_config_get_tank_geometry_length_cm(),
+      .width_cm = mgos_sys_config_get_tank_geometry_width_cm(),
+      .height_cm = mgos_sys_config_get_tank_geometry_height_cm()};
+
+  bool ok;
+  if (geometry.shape == TANK_SHAPE_STRAPPING)
+    ok = tank_geometry_load_strapping(mgos_sys_config_get_tank_geometry_strapping_file());
+  else
+    ok = tank_geometry_init(&geometry);
+
+  if (!ok)
+  {
+    LOG(LL_ERROR, ("%s, using the default tank instead of %s", TAG, mgos_sys_config_get_tank_geometry_shape()));
+    tank_geometry_init(&default_geometry);
+  }
+  return ok;
+}
+
+float tank_geometry_liters(float height_cm)
+{
+  float position = height_cm * table_scale;
+  if (position <= 0)
+    return volume_table[0];
+  if (position >= TANK_GEOMETRY_INTERVALS)
+    return volume_table[TANK_GEOMETRY_INTERVALS];
+  int index = (int)position;
+  float fraction = position - index;
+  return volume_table[index] + fraction * (volume_table[index + 1] - volume_table[index]);
+}
+
+float tank_geometry_max_height_cm(void)
+{
+  return max_height_cm;
+}
+
+float tank_geometry_max_liters(void)
+{
+  return volume_table[TANK_GEOMETRY_INTERVALS];
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "stdbool.h"
+
+// water height to volume for the supported tank shapes
+// the volume is tabulated at init at evenly spaced heights, a lookup is
+// one multiplication and a linear interpolation between two entries
+typedef enum tank_shape
+{
+  TANK_SHAPE_HORIZONTAL_CYLINDER = 0,
+  TANK_SHAPE_VERTICAL_CYLINDER,
+  TANK_SHAPE_RECTANGULAR,
+  // horizontal cylinder with hemispherical ends, length is the cylindrical part
+  TANK_SHAPE_CAPSULE,
+  // height,liters pairs from a file
+  TANK_SHAPE_STRAPPING,
+  TANK_SHAPE_INVALID
+} tank_shape_t;
+
+typedef struct tank_geometry tank_geometry_t;
+struct tank_geometry
+{
+  tank_shape_t shape;
+  float diameter_cm;
+  float length_cm;
+  float width_cm;
+  float height_cm;
+};
+
+// table intervals, the table has one more entry
+#define TANK_GEOMETRY_INTERVALS 256
+// points read from a strapping file
+#define TANK_STRAPPING_MAX_POINTS 64
+
+tank_shape_t tank_shape_from_name(const char *name);
+const char *tank_shape_name(tank_shape_t shape);
+
+// builds the table for one of the computed shapes
+bool tank_geometry_init(const tank_geometry_t *geometry);
+// builds the table from a strapping file, a line per point
+//   <height_cm>,<liters>
+// heights increasing from 0, lines starting with # are ignored
+bool tank_geometry_load_strapping(const char *path);
+// tank.geometry from mos.yml, falls back to the default tank on errors
+bool tank_geometry_init_from_config(void);
+
+float tank_geometry_liters(float height_cm);
+float tank_geometry_max_height_cm(void);
+float tank_geometry_max_liters(void);
+// direct evaluation of the formulas the table is built from
+float tank_geometry_exact_liters(const tank_geometry_t *geometry, float height_cm);
@@ -0,0 +1,368 @@
+#include "math.h"
+#include "mgos.h"
+#include "frozen.h"
+
+#include "tank_report.h"
+
+#if SENSING_TASK==1
+#include "mgos_freertos.h"
+// the sensing task and the mgos task both write, the spinlock keeps one
+// writer at a time and a writer is never preempted in the middle
+static portMUX_TYPE report_mux = portMUX_INITIALIZER_UNLOCKED;
+#define REPORT_WRITE_LOCK() portENTER_CRITICAL(&report_mux)
+#define REPORT_WRITE_UNLOCK() portEXIT_CRITICAL(&report_mux)
+#else
+#define REPORT_WRITE_LOCK()
+#define REPORT_WRITE_UNLOCK()
+#endif
+
+char *status_text[] = {
+    [TANK_LOW] = "low",
+    [TANK_NORMAL] = "normal",
+    [TANK_FULL] = "full"};
+
+struct sensor_info sensor_info = {
+    .timestamp = 0,
+    .air_temperature = 0.0,
+    .air_pressure = 0.0,
+    .air_humidity = 0.0,
+    .tank_status = TANK_LOW,
+    .tank_overflow = false,
+    .tank_liters = 0.0,
+    .tank_percentage = 0.0,
+    .tank_rate_lpm = 0.0,
+    .tank_seconds_to_full = -1,
+    .tank_seconds_to_empty = -1,
+    .tank_overflow_volume_valid = false,
+    .tank_overflow_liters = 0.0,
+    .tank_overflow_event_liters = 0.0,
+    .version = 0
+};
+
+// changes of the counter frequency below this are not reported
+static const float counter_frequency_resolution = 0.01;
+
+struct sensor_raw sensor_raw = {
+  .timestamp          = 0,
+  .tank_pressure_adc  = 0,
+  .counter_count      = 0,
+  .counter_frequency  = 0,
+  .version            = 0
+};
+
+// seqlock, odd while a write is in progress, readers copy and retry
+// when the sequence moved, they never block a writer
+static uint32_t report_sequence = 0;
+
+static void report_write_begin(void)
+{
+  REPORT_WRITE_LOCK();
+  __atomic_store_n(&report_sequence, report_sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void report_write_end(void)
+{
+  __atomic_store_n(&report_sequence, report_sequence + 1, __ATOMIC_RELEASE);
+  REPORT_WRITE_UNLOCK();
+}
+
+void tank_report_snapshot(struct sensor_info *info, struct sensor_raw *raw)
+{
+  uint32_t sequence;
+  do
+  {
+    while ((sequence = __atomic_load_n(&report_sequence, __ATOMIC_ACQUIRE)) & 1)
+      ;
+    if (info != NULL)
+      *info = sensor_info;
+    if (raw != NULL)
+      *raw = sensor_raw;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while (__atomic_load_n(&report_sequence, __ATOMIC_RELAXED) != sequence);
+}
+
+static int report_status_printf(struct json_out *out, const struct sensor_info *info)
+{
+  int len = json_printf(out,
+              "{"
+              "timestamp: %d,"
+              "air_temperature: %4.2f,"
+              "air_pressure: %5.1f,"
+              "air_humidity: %4.1f,"
+              "tank_liters: %4.1f,"
+              "tank_percentage: %3.1f,"
+              "tank_rate: %.1f,"
+              "tank_seconds_to_full: %d,"
+              "tank_seconds_to_empty: %d,"
+              "tank_status: \"%s\","
+              "tank_overflow: %B",
+              (int)info->timestamp,
+              info->air_temperature,
+              info->air_pressure,
+              info->air_humidity,
+              info->tank_liters,
+              info->tank_percentage,
+              info->tank_rate_lpm,
+              (int)info->tank_seconds_to_full,
+              (int)info->tank_seconds_to_empty,
+              status_text[info->tank_status],
+              info->tank_overflow);
+  if (info->tank_overflow_volume_valid)
+    len += json_printf(out,
+              ","
+              "tank_overflow_liters: %.1f,"
+              "tank_overflow_event_liters: %.1f",
+              info->tank_overflow_liters,
+              info->tank_overflow_event_liters);
+  len += json_printf(out, "}");
+  return len;
+}
+
+static int report_raw_printf(struct json_out *out, const struct sensor_raw *raw)
+{
+  return json_printf(out,
+                "{"
+                "timestamp: %d,"
+                "tank_pressure_adc: %d,"
+                "tank_pressure_mv: %.1f,"
+                "tank_overflow_count: %d,"
+                "tank_overflow_frequency: %.2f"
+                "}",
+                (int)raw->timestamp,
+                raw->tank_pressure_adc,
+                raw->tank_pressure_mv,
+                raw->counter_count,
+                raw->counter_frequency
+                );
+}
+
+// caller has to dispose of memory
+const struct mbuf *getSatusAsJSON(struct mbuf *buffer)
+{
+  struct json_out json_result = JSON_OUT_MBUF(buffer);
+  struct sensor_info info;
+  tank_report_snapshot(&info, NULL);
+  report_status_printf(&json_result, &info);
+  return buffer;
+}
+
+const struct mbuf *getRawAsJSON(struct mbuf *buffer)
+{
+  struct json_out json_result = JSON_OUT_MBUF(buffer);
+  struct sensor_raw raw;
+  tank_report_snapshot(NULL, &raw);
+  report_raw_printf(&json_result, &raw);
+  return buffer;
+}
+
+// the payloads live in a static arena, one slot per kind, serializing and
+// publishing never touch the heap. All consumers copy the payload before
+// they return so one slot per kind is enough.
+#define REPORT_STATUS_PAYLOAD_SIZE 512
+#define REPORT_RAW_PAYLOAD_SIZE 192
+
+static char payload_arena[REPORT_STATUS_PAYLOAD_SIZE + REPORT_RAW_PAYLOAD_SIZE];
+
+typedef struct report_payload report_payload_t;
+struct report_payload
+{
+  // points into the arena, never handed to the mbuf functions
+  struct mbuf view;
+  uint32_t version;
+  bool valid;
+  size_t high_water;
+  uint32_t rebuilds;
+  uint32_t truncations;
+};
+
+static report_payload_t status_payload = {
+    .view = {.buf = payload_arena, .size = REPORT_STATUS_PAYLOAD_SIZE}};
+static report_payload_t raw_payload = {
+    .view = {.buf = payload_arena + REPORT_STATUS_PAYLOAD_SIZE, .size = REPORT_RAW_PAYLOAD_SIZE}};
+
+// length of the serialized payload, 0 if it did not fit the slot
+static void report_payload_store(report_payload_t *payload, uint32_t version, int len)
+{
+  payload->rebuilds++;
+  if (len < 0 || (size_t)len >= payload->view.size)
+  {
+    if (payload->truncations++ == 0)
+      LOG(LL_ERROR, ("Report payload of %d bytes does not fit %u", len, (unsigned)payload->view.size));
+    len = 0;
+    payload->view.buf[0] = '\0';
+  }
+  payload->view.len = len;
+  if ((size_t)len > payload->high_water)
+    payload->high_water = len;
+  payload->version = version;
+  payload->valid = true;
+}
+
+// the payload is serialized from the same snapshot its version comes from
+const struct mbuf *tank_report_status_json(void)
+{
+  struct sensor_info info;
+  tank_report_snapshot(&info, NULL);
+  if (status_payload.valid && status_payload.version == info.version)
+    return &status_payload.view;
+  struct json_out out = JSON_OUT_BUF(status_payload.view.buf, status_payload.view.size);
+  report_payload_store(&status_payload, info.version, report_status_printf(&out, &info));
+  return &status_payload.view;
+}
+
+const struct mbuf *tank_report_raw_json(void)
+{
+  struct sensor_raw raw;
+  tank_report_snapshot(NULL, &raw);
+  if (raw_payload.valid && raw_payload.version == raw.version)
+    return &raw_payload.view;
+  struct json_out out = JSON_OUT_BUF(raw_payload.view.buf, raw_payload.view.size);
+  report_payload_store(&raw_payload, raw.version, report_raw_printf(&out, &raw));
+  return &raw_payload.view;
+}
+
+static int report_payload_to_json(struct json_out *out, const report_payload_t *payload)
+{
+  return json_printf(out, "{size:%u, high_water:%u, rebuilds:%u, truncations:%u}",
+                     (unsigned)payload->view.size, (unsigned)payload->high_water,
+                     (unsigned)payload->rebuilds, (unsigned)payload->truncations);
+}
+
+int tank_report_payload_to_json(struct json_out *out)
+{
+  int len = json_printf(out, "{status:");
+  len += report_payload_to_json(out, &status_payload);
+  len += json_printf(out, ", raw:");
+  len += report_payload_to_json(out, &raw_payload);
+  len += json_printf(out, "}");
+  return len;
+}
+
+// time(NULL) takes a lock, it is read before the write starts
+void tank_report_set_environment(double air_temperature, double air_pressure, double air_humidity)
+{
+  time_t now = time(NULL);
+  report_write_begin();
+  sensor_info.timestamp = now;
+  sensor_info.air_temperature = air_temperature;
+  sensor_info.air_pressure = air_pressure;
+  sensor_info.air_humidity = air_humidity;
+  sensor_info.version++;
+  report_write_end();
+}
+
+void tank_report_set_pressure(const pressure_status_t *pressure_status)
+{
+  time_t now = time(NULL);
+  report_write_begin();
+  sensor_raw.timestamp = now;
+  sensor_raw.tank_pressure_adc = pressure_status->raw_adc;
+  sensor_raw.tank_pressure_mv = pressure_status->millivolts;
+  sensor_raw.version++;
+  report_write_end();
+}
+
+void tank_report_set_volume(const tank_volume_t *tank_volume, float liters_low, float liters_high)
+{
+  // text key representing status will be added in the
+  // JSON preparation function
+
+  tank_status_t tank_status = TANK_NORMAL;
+  if (tank_volume->tank_liters < liters_low)
+  {
+    tank_status = TANK_LOW;
+  }
+  if (tank_volume->tank_liters > liters_high)
+  {
+    tank_status = TANK_FULL;
+  }
+
+  time_t now = time(NULL);
+  report_write_begin();
+  sensor_info.timestamp = now;
+  sensor_info.tank_liters = tank_volume->tank_liters;
+  sensor_info.tank_percentage = tank_volume->tank_percentage;
+  sensor_info.tank_rate_lpm = tank_volume->tank_rate_lpm;
+  sensor_info.tank_seconds_to_full = tank_volume->tank_seconds_to_full;
+  sensor_info.tank_seconds_to_empty = tank_volume->tank_seconds_to_empty;
+  sensor_info.tank_status = tank_status;
+  sensor_info.version++;
+  report_write_end();
+}
+
+bool tank_report_set_counter(const gpio_counter_t *gpio_counter)
+{
+  time_t now = time(NULL);
+  report_write_begin();
+  bool changed = sensor_raw.counter_count != gpio_counter->count || fabs(sensor_raw.counter_frequency - gpio_counter->frequency) >= counter_frequency_resolution;
+  if (changed)
+  {
+    sensor_raw.timestamp = now;
+    sensor_raw.counter_count = gpio_counter->count;
+    sensor_raw.counter_frequency = gpio_counter->frequency;
+    sensor_raw.version++;
+  }
+  report_write_end();
+  return changed;
+}
+
+static bool report_set_tank_overflow(bool tank_overflow)
+{
+  time_t now = time(NULL);
+  report_write_begin();
+  bool changed = sensor_info.tank_overflow != tank_overflow;
+  if (changed)
+  {
+    sensor_info.timestamp = now;
+    sensor_info.tank_overflow = tank_overflow;
+    sensor_info.version++;
+  }
+  report_write_end();
+  return changed;
+}
+
+bool tank_report_set_overflow(const gpio_counter_t *gpio_counter, int freq_thr_hz)
+{
+  if(freq_thr_hz == 0) return false;
+
+  bool tank_overflow = false;
+  if (gpio_counter->frequency >= freq_thr_hz)
+  {
+    tank_overflow = true;
+  }
+  return report_set_tank_overflow(tank_overflow);
+}
+
+bool tank_report_set_overflow_alarm(void)
+{
+  return report_set_tank_overflow(true);
+}
+
+void tank_report_set_overflow_volume(double liters, double event_liters)
+{
+  report_write_begin();
+  // called for every counter reading, the cached payload is kept without pulses
+  if (!sensor_info.tank_overflow_volume_valid || sensor_info.tank_overflow_liters != liters ||
+      sensor_info.tank_overflow_event_liters != event_liters)
+  {
+    sensor_info.tank_overflow_volume_valid = true;
+    sensor_info.tank_overflow_liters = liters;
+    sensor_info.tank_overflow_event_liters = event_liters;
+    sensor_info.version++;
+  }
+  report_write_end();
+}
+
+void tank_report_refresh_timestamp(time_t *last_timestamp)
+{
+  time_t now = time(NULL);
+  report_write_begin();
+  if (sensor_info.timestamp == *last_timestamp && now != *last_timestamp)
+  {
+    sensor_info.timestamp = now;
+    sensor_info.version++;
+  }
+  *last_timestamp = sensor_info.timestamp;
+  report_write_end();
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "stdbool.h"
+#include "time.h"
+
+#include "common/mbuf.h"
+
+#include "sensor_pressure.h"
+#include "sensor_counter.h"
+#include "tank_volume.h"
+
+struct json_out;
+
+typedef enum tank_status
+{
+  TANK_LOW = 0,
+  TANK_NORMAL,
+  TANK_FULL,
+} tank_status_t;
+
+extern char *status_text[];
+
+struct sensor_info
+{
+  time_t timestamp;
+  double air_temperature;
+  double air_pressure;
+  double air_humidity;
+  tank_status_t tank_status;
+  bool tank_overflow;
+  float tank_liters;
+  float tank_percentage;
+  float tank_rate_lpm;
+  float tank_seconds_to_full;
+  float tank_seconds_to_empty;
+  // set by the totalizer, left out of the status until it runs
+  bool tank_overflow_volume_valid;
+  double tank_overflow_liters;
+  double tank_overflow_event_liters;
+  // bumped on every change, the serialized payload is cached per version
+  uint32_t version;
+};
+
+struct sensor_raw
+{
+  time_t    timestamp;
+  uint16_t  tank_pressure_adc;
+  float     tank_pressure_mv;
+  uint16_t  counter_count;
+  float     counter_frequency;
+  uint32_t  version;
+};
+
+// written through the setters below, read with tank_report_snapshot
+extern struct sensor_info sensor_info;
+extern struct sensor_raw sensor_raw;
+
+// consistent copies, either may be NULL, safe against a writer on another task
+void tank_report_snapshot(struct sensor_info *info, struct sensor_raw *raw);
+
+// caller has to dispose of memory
+const struct mbuf *getSatusAsJSON(struct mbuf *buffer);
+const struct mbuf *getRawAsJSON(struct mbuf *buffer);
+// serialized once per version into a static slot and shared by all
+// consumers, read only, NUL terminated, valid until the next call, empty
+// if it did not fit the slot, mgos task only
+const struct mbuf *tank_report_status_json(void);
+const struct mbuf *tank_report_raw_json(void);
+// slot sizes, high water marks and truncations of the payload arena
+int tank_report_payload_to_json(struct json_out *out);
+
+// update the report from sensor events
+// the caller decides how and when to notify listeners
+void tank_report_set_environment(double air_temperature, double air_pressure, double air_humidity);
+void tank_report_set_pressure(const pressure_status_t *pressure_status);
+void tank_report_set_volume(const tank_volume_t *tank_volume, float liters_low, float liters_high);
+// true if the raw counter reading changed
+bool tank_report_set_counter(const gpio_counter_t *gpio_counter);
+// true if the overflow status changed, threshold of 0 disables overflow detection
+bool tank_report_set_overflow(const gpio_counter_t *gpio_counter, int freq_thr_hz);
+// cumulative liters through the overflow, reported with the next status
+void tank_report_set_overflow_volume(double liters, double event_liters);
+// overflow from the counter alarm, true if the status changed
+bool tank_report_set_overflow_alarm(void);
+// a status sent again with the same timestamp gets the current time
+void tank_report_refresh_timestamp(time_t *last_timestamp);
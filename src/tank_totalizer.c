@@ -0,0 +1,209 @@
+#include "math.h"
+#include "stddef.h"
+#include "stdio.h"
+
+#include "mgos.h"
+#include "mgos_system.h"
+#include "mgos_sys_config.h"
+#include "frozen.h"
+
+#include "sensor_counter.h"
+#include "tank_report.h"
+#include "tank_totalizer.h"
+
+#if defined(__XTENSA__)
+#include "esp_attr.h"
+// not cleared on a soft reset, garbage after a power on
+#define TOTALIZER_RTC_ATTR RTC_NOINIT_ATTR
+#else
+#define TOTALIZER_RTC_ATTR
+#endif
+
+#define TAG "Tank totalizer"
+
+#define TOTALIZER_MAGIC 0x544f544c
+// pulses are kept in thousandths, integer sums do not lose small readings
+#define MILLI_PULSES 1000
+// a longer gap between readings is a stopped counter, not flow
+static const int64_t totalizer_max_gap_us = 5000000;
+// flash writes, a change of at least checkpoint_delta liters and then one
+// write per checkpoint_interval, the RTC copy covers soft resets
+static const double totalizer_checkpoint_delta_liters = 1.0;
+static const double totalizer_checkpoint_interval_s = 3600;
+
+typedef struct totalizer_state totalizer_state_t;
+struct totalizer_state
+{
+  uint32_t magic;
+  uint64_t milli_pulses;
+  // at the start of the running or the last overflow event
+  uint64_t event_start_milli_pulses;
+  uint64_t event_milli_pulses;
+  uint32_t events;
+  uint32_t checksum;
+};
+
+static TOTALIZER_RTC_ATTR totalizer_state_t state;
+
+static float k_factor = 450;
+static bool overflow_ = false;
+static int64_t last_timestamp_us = -1;
+static uint64_t saved_milli_pulses = 0;
+static double saved_at_s = 0;
+static uint16_t writes = 0;
+
+static uint32_t state_checksum(const totalizer_state_t *s)
+{
+  const uint8_t *p = (const uint8_t *)s;
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < offsetof(totalizer_state_t, checksum); i++)
+    hash = (hash ^ p[i]) * 16777619u;
+  return hash;
+}
+
+static bool state_valid(const totalizer_state_t *s)
+{
+  return s->magic == TOTALIZER_MAGIC && s->checksum == state_checksum(s) &&
+         s->event_start_milli_pulses <= s->milli_pulses;
+}
+
+static void state_seal(void)
+{
+  state.magic = TOTALIZER_MAGIC;
+  state.checksum = state_checksum(&state);
+}
+
+static double milli_pulses_to_liters(uint64_t milli_pulses)
+{
+  return (double)milli_pulses / MILLI_PULSES / k_factor;
+}
+
+static bool totalizer_load(const char *path, totalizer_state_t *loaded)
+{
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+    return false;
+  unsigned long long milli_pulses, event_milli_pulses;
+  unsigned events;
+  int n = fscanf(file, "%llu,%llu,%u", &milli_pulses, &event_milli_pulses, &events);
+  fclose(file);
+  if (n != 3)
+  {
+    LOG(LL_ERROR, ("%s, bad state in %s", TAG, path));
+    return false;
+  }
+  *loaded = (totalizer_state_t){
+      .milli_pulses = milli_pulses,
+      .event_start_milli_pulses = milli_pulses,
+      .event_milli_pulses = event_milli_pulses,
+      .events = events};
+  return true;
+}
+
+// bounded writes, the flash sees at most one write per checkpoint interval
+static void totalizer_checkpoint(void)
+{
+  double now_s = mgos_uptime();
+  if (milli_pulses_to_liters(state.milli_pulses - saved_milli_pulses) < totalizer_checkpoint_delta_liters)
+    return;
+  // the first write as soon as the delta is reached, the RTC copy does
+  // not survive a power loss
+  if (writes > 0 && now_s - saved_at_s < totalizer_checkpoint_interval_s)
+    return;
+
+  FILE *file = fopen(mgos_sys_config_get_tank_totalizer_file(), "w");
+  if (file == NULL)
+    return;
+  fprintf(file, "%llu,%llu,%u\n", (unsigned long long)state.milli_pulses,
+          (unsigned long long)state.event_milli_pulses, (unsigned)state.events);
+  if (fclose(file) != 0)
+    return;
+  saved_milli_pulses = state.milli_pulses;
+  saved_at_s = now_s;
+  writes++;
+}
+
+static void totalizer_counter_cb(int ev, void *evd, void *user_data UNUSED_ARG)
+{
+  if (ev != COUNTER_CHANGE)
+    return;
+  gpio_counter_t *gpio_counter = evd;
+  uint64_t milli_pulses = 0;
+  int64_t gap_us = gpio_counter->timestamp_us - last_timestamp_us;
+  if (last_timestamp_us >= 0 && gap_us > 0 && gap_us <= totalizer_max_gap_us)
+    milli_pulses = llround(gpio_counter->frequency * MILLI_PULSES * (gap_us / 1000000.0));
+  last_timestamp_us = gpio_counter->timestamp_us;
+
+  int freq_thr_hz = mgos_sys_config_get_tank_frequency_high_threshold();
+  bool overflow = freq_thr_hz > 0 && gpio_counter->frequency >= freq_thr_hz;
+  if (overflow && !overflow_)
+  {
+    state.event_start_milli_pulses = state.milli_pulses;
+    state.events++;
+  }
+  state.milli_pulses += milli_pulses;
+  if (overflow)
+    state.event_milli_pulses = state.milli_pulses - state.event_start_milli_pulses;
+  bool event_changed = overflow != overflow_;
+  overflow_ = overflow;
+  // most readings without flow change nothing, the report is not touched
+  if (milli_pulses > 0 || event_changed)
+  {
+    state_seal();
+    tank_report_set_overflow_volume(tank_totalizer_liters(), tank_totalizer_event_liters());
+  }
+  // a write put off by the interval goes out once the flow stopped
+  totalizer_checkpoint();
+}
+
+bool tank_totalizer_init(void)
+{
+  k_factor = mgos_sys_config_get_tank_totalizer_k_factor();
+  if (!(k_factor > 0))
+  {
+    LOG(LL_ERROR, ("%s, K-factor %f is not valid", TAG, k_factor));
+    return false;
+  }
+
+  totalizer_state_t loaded;
+  bool have_file = totalizer_load(mgos_sys_config_get_tank_totalizer_file(), &loaded);
+  // the RTC copy is newer than the checkpoint unless the power was lost
+  if (state_valid(&state))
+  {
+    // an event does not run across a reset
+    state.event_start_milli_pulses = state.milli_pulses;
+    LOG(LL_INFO, ("%s, restored %.1f liters from RTC memory", TAG, tank_totalizer_liters()));
+  }
+  else if (have_file)
+  {
+    state = loaded;
+    LOG(LL_INFO, ("%s, restored %.1f liters from the checkpoint", TAG, tank_totalizer_liters()));
+  }
+  else
+  {
+    state = (totalizer_state_t){0};
+  }
+  state_seal();
+  saved_milli_pulses = have_file ? loaded.milli_pulses : 0;
+
+  tank_report_set_overflow_volume(tank_totalizer_liters(), tank_totalizer_event_liters());
+  mgos_event_add_group_handler(COUNTER_EVENT_BASE, totalizer_counter_cb, NULL);
+  return true;
+}
+
+double tank_totalizer_liters(void)
+{
+  return milli_pulses_to_liters(state.milli_pulses);
+}
+
+double tank_totalizer_event_liters(void)
+{
+  return milli_pulses_to_liters(state.event_milli_pulses);
+}
+
+int tank_totalizer_to_json(struct json_out *out)
+{
+  return json_printf(out, "{liters:%.2f, event_liters:%.2f, events:%u, k_factor:%.2f, writes:%u}",
+                     tank_totalizer_liters(), tank_totalizer_event_liters(), (unsigned)state.events,
+                     k_factor, (unsigned)writes);
+}
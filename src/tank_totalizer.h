@@ -0,0 +1,18 @@
+#pragma once
+
+#include "stdbool.h"
+#include "stdint.h"
+
+struct json_out;
+
+// cumulative volume through the overflow flow sensor, the pulses of every
+// counter reading are its frequency over the time since the previous one
+// so the gaps between gates are extrapolated from the gate frequency, not
+// counted, about 9% of the total in the gate mode. Kept in pulses, the K-factor
+// only scales the reported liters. The state survives a soft reset in RTC
+// memory and a power loss in a checkpoint file written at most hourly
+bool tank_totalizer_init(void);
+double tank_totalizer_liters(void);
+// liters of the running overflow event, or of the last one
+double tank_totalizer_event_liters(void);
+int tank_totalizer_to_json(struct json_out *out);
@@ -1,27 +1,72 @@
 #include "math.h"
+#include "stdio.h"
+#include "string.h"
 
 #include "mgos.h"
 #include "mgos_bme280.h"
+#include "mgos_sys_config.h"
+#include "frozen.h"
 
 #include "sensor_pressure.h"
 #include "sensor_bme280.h"
 #include "tank_volume.h"
+#include "tank_geometry.h"
+#include "tank_drift.h"
 #include "sensor.h"
+#if PRESSURE_MILLIVOLTS==1
+#include "adc_cal.h"
+#endif
 
 static tank_volume_t tank_volume = {
     .tank_percentage = 0,
-    .tank_liters = 0};
+    .tank_liters = 0,
+    .tank_rate_lpm = 0,
+    .tank_seconds_to_full = -1,
+    .tank_seconds_to_empty = -1};
 
-// tank is a cylinder lying on it's side width of 100cm and diameter 50cm
-static const float tank_radius_cm = 25.0;
-static const float tank_length_cm = 100.0;
-static const float tank_radius_squared_cm2 = tank_radius_cm * tank_radius_cm;
-static const float tank_maximum_liters = 196.3;
+// rate from a line through the last minute of volumes, 2.5 s apart
+// a rate below the dead band is noise, no time to full or empty
+#define TANK_RATE_WINDOW 24
+static const float tank_rate_dead_band_lpm = 0.5;
+static sensor_window_regression_t tank_rate_regression;
+
+// tank shape and size come from tank.geometry, see tank_geometry.h
 static const float tank_liters_change_report_threshold = 1.8;
 
 static const float temp_compensation_coeff = 4.35; //5.55
 
+// written on the mgos task, read by the sample, both under the sensing lock
+// so the pair is consistent and a double does not tear
 static double env_temperature = 0.0;
+static double env_air_pressure = 0.0;
+// a level that moves less than this in a minute is static, in ADC codes
+static const float drift_static_tolerance = 3;
+// last temperature compensated pressure, the x of a captured calibration point
+static float compensated_pressure_ = 0;
+static bool compensated_pressure_valid_ = false;
+
+float tank_volume_liters(float tank_water_height_cm)
+{
+  return tank_geometry_liters(tank_water_height_cm);
+}
+
+static void tank_rate_update(float liters)
+{
+  number_type liters_per_s;
+  window_regression_add(&tank_rate_regression, mgos_uptime(), liters);
+  tank_volume.tank_seconds_to_full = -1;
+  tank_volume.tank_seconds_to_empty = -1;
+  if (!window_regression_slope(&tank_rate_regression, &liters_per_s))
+  {
+    tank_volume.tank_rate_lpm = 0;
+    return;
+  }
+  tank_volume.tank_rate_lpm = liters_per_s * 60;
+  if (tank_volume.tank_rate_lpm >= tank_rate_dead_band_lpm)
+    tank_volume.tank_seconds_to_full = (tank_geometry_max_liters() - liters) / liters_per_s;
+  else if (tank_volume.tank_rate_lpm <= -tank_rate_dead_band_lpm)
+    tank_volume.tank_seconds_to_empty = liters / -liters_per_s;
+}
 
 void on_tank_water_height_change(observable_value_t *this)
 {
@@ -30,9 +75,9 @@ void on_tank_water_height_change(observable_value_t *this)
 
   LOG(LL_INFO, ("Water height %f", tank_water_height_cm));
 
-  float tank_volume_cm3 = tank_length_cm * (tank_radius_squared_cm2 * acos(1 - tank_water_height_cm / tank_radius_cm) - (tank_radius_cm - tank_water_height_cm) * sqrt(2 * tank_radius_cm * tank_water_height_cm - pow(tank_water_height_cm, 2)));
-  tank_volume.tank_liters = tank_volume_cm3 / 1000.0;
-  tank_volume.tank_percentage = tank_volume.tank_liters / tank_maximum_liters * 100.0;
+  tank_volume.tank_liters = tank_volume_liters(tank_water_height_cm);
+  tank_volume.tank_percentage = tank_volume.tank_liters / tank_geometry_max_liters() * 100.0;
+  tank_rate_update(tank_volume.tank_liters);
   // decide if we need to report based on liters change
   if( tank_volume.tank_percentage < 100.0 && fabs(tank_volume.tank_liters - last_reported_liters) < tank_liters_change_report_threshold ) return;
 
@@ -40,77 +85,288 @@ void on_tank_water_height_change(observable_value_t *this)
   last_reported_liters = tank_volume.tank_liters;
 }
 
-static observable_value_t tank_water_height = {
-    .value.value = 0,
-    .name = "tank_water_height",
-    .filters = ((void *)NULL),
-    .observers = ((void *)NULL),
-    .set = set_value,
-    .process = process_new_value,
-    .notify = notify_observers,
-};
-
 // fit pressure to percentage
 static filter_item_linear_fit_t pressure_percentage_fit = {
     .super.filter = filter_item_linear_fit_fn,
+    .super.block_filter = filter_item_linear_fit_block_fn,
     .value_map = {{0, 0}, {0, 0}},
     .slope_ = 0,
     .intercept_ = 0};
 
 static filter_item_clamp_t clamp_percentage = {
     .super.filter = filter_item_clamp_fn,
+    .super.block_filter = filter_item_clamp_block_fn,
     .min = 0,
     .max = 100};
 
 // fit percentage to water height
 filter_item_linear_fit_t percentage_water_height_fit = {
     .super.filter = filter_item_linear_fit_fn,
+    .super.block_filter = filter_item_linear_fit_block_fn,
     .value_map = {{0, 0}, {0, 0}},
     .slope_ = 0,
     .intercept_ = 0};
 
+// the three filters above fused in one kernel
+static filter_item_affine_clamp_t pressure_water_height_fit = {
+    .super.filter = filter_item_affine_clamp_fn,
+    .super.block_filter = filter_item_affine_clamp_block_fn,
+    .slope = 0,
+    .intercept = 0,
+    .min = 0,
+    .max = 0};
+
+#define TANK_WATER_HEIGHT_CHAIN(STAGE) \
+  STAGE(affine_clamp, pressure_water_height_fit)
+
+FILTER_CHAIN(tank_water_height_chain, TANK_WATER_HEIGHT_CHAIN)
+
+// pressure to water height through a captured calibration curve
+// replaces the chain above while a calibration is active
+static filter_item_calibration_t pressure_water_height_calibration = {
+    .super.filter = filter_item_calibration_fn,
+    .super.block_filter = filter_item_calibration_block_fn,
+    .monotone = true,
+    .points_count = 0};
+
+#define TANK_WATER_HEIGHT_CALIBRATED_CHAIN(STAGE) \
+  STAGE(calibration, pressure_water_height_calibration)
+
+FILTER_CHAIN(tank_water_height_calibrated_chain, TANK_WATER_HEIGHT_CALIBRATED_CHAIN)
+
+// points captured with tank_volume_calibration_capture, not used until applied
+static filter_item_calibration_t captured_calibration = {
+    .monotone = true,
+    .points_count = 0};
+
+static observable_value_t tank_water_height = {
+    .value.value = 0,
+    .name = "tank_water_height",
+    .chain = &tank_water_height_chain,
+    .filters = ((void *)NULL),
+    .set = set_value,
+    .process = process_new_value,
+    .notify = notify_observers,
+};
+
 static void bme280_cb(int ev, void *evd, void *user_data UNUSED_ARG)
 {
   if(ev != ENV_MEASUREMENT) return;
   struct mgos_bme280_data *environment_status = evd;
+  sensor_pressure_lock();
   env_temperature = environment_status->temp;
+  env_air_pressure = environment_status->press;
+  sensor_pressure_unlock();
 }
 
 static void pressure_volume_cb(int ev, void *evd, void *user_data UNUSED_ARG)
 {
   if(ev != PRESSURE_MEASUREMENT) return;
   pressure_status_t *pressure_status = evd;
-  // do the temperature compensation of the pressure sensor raw adc
-  int compensated_adc = (int)((float)pressure_status->raw_adc - env_temperature * temp_compensation_coeff);
-  tank_water_height.process(&tank_water_height, compensated_adc);
+  // do the temperature compensation of the pressure sensor reading
+#if PRESSURE_MILLIVOLTS==1
+  float pressure = pressure_status->millivolts;
+#else
+  float pressure = pressure_status->raw_adc;
+#endif
+  float compensated_pressure;
+  if (tank_drift_enabled())
+  {
+    // offset learned while the level is static, see tank_drift.h
+    compensated_pressure = pressure - tank_drift_offset(pressure, env_temperature, env_air_pressure);
+  }
+  else
+  {
+#if PRESSURE_MILLIVOLTS==1
+    // the coefficient is in ADC codes, scaled by the calibrated slope
+    float compensation_coeff = temp_compensation_coeff * adc_cal_mv_per_count(pressure);
+    compensated_pressure = pressure - env_temperature * compensation_coeff;
+#else
+    compensated_pressure = (int)(pressure - env_temperature * temp_compensation_coeff);
+#endif
+  }
+  compensated_pressure_ = compensated_pressure;
+  compensated_pressure_valid_ = true;
+  tank_water_height.process(&tank_water_height, compensated_pressure);
 }
 
 void tank_volume_set_threshold(float pressure_low_threshold, float pressure_high_threshold) 
 {
+  sensor_pressure_lock();
   pressure_percentage_fit.value_map[0][0] = pressure_low_threshold;
   pressure_percentage_fit.value_map[0][1] = 0;
   pressure_percentage_fit.value_map[1][0] = pressure_high_threshold;
   pressure_percentage_fit.value_map[1][1] = 100;
 
   filter_linear_fit_calc(&pressure_percentage_fit);
+  filter_affine_clamp_fuse(&pressure_water_height_fit, &pressure_percentage_fit, &clamp_percentage, &percentage_water_height_fit);
+  sensor_pressure_unlock();
+}
+
+bool tank_volume_compensated_pressure(float *pressure)
+{
+  sensor_pressure_lock();
+  *pressure = compensated_pressure_;
+  bool valid = compensated_pressure_valid_;
+  sensor_pressure_unlock();
+  return valid;
+}
+
+bool tank_volume_calibration_active(void)
+{
+  return tank_water_height.chain == &tank_water_height_calibrated_chain;
+}
+
+bool tank_volume_calibration_load(const char *path)
+{
+  filter_item_calibration_t *calibration = &pressure_water_height_calibration;
+  char line[64];
+  bool ok = true;
+
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+    return false;
+  calibration->points_count = 0;
+  while (ok && fgets(line, sizeof(line), file) != NULL)
+  {
+    float pressure, height_cm;
+    if (line[0] == '#' || line[0] == '\r' || line[0] == '\n')
+      continue;
+    if (calibration->points_count == SENSOR_CALIBRATION_MAX_POINTS || sscanf(line, "%f,%f", &pressure, &height_cm) != 2)
+    {
+      ok = false;
+      break;
+    }
+    calibration->x[calibration->points_count] = pressure;
+    calibration->y[calibration->points_count] = height_cm;
+    calibration->points_count++;
+  }
+  fclose(file);
+  if (!ok || !filter_calibration_calc(calibration))
+  {
+    LOG(LL_ERROR, ("Bad calibration table %s, using the pressure thresholds", path));
+    calibration->points_count = 0;
+    return false;
+  }
+  tank_water_height.chain = &tank_water_height_calibrated_chain;
+  LOG(LL_INFO, ("Calibration table %s, %d points", path, calibration->points_count));
+  return true;
+}
+
+static bool calibration_save(const char *path, const filter_item_calibration_t *calibration)
+{
+  FILE *file = fopen(path, "w");
+  if (file == NULL)
+    return false;
+  fprintf(file, "# compensated pressure,water height cm\n");
+  for (uint8_t i = 0; i < calibration->points_count; i++)
+    fprintf(file, "%.2f,%.2f\n", calibration->x[i], calibration->y[i]);
+  return fclose(file) == 0;
+}
+
+bool tank_volume_calibration_capture(float height_cm)
+{
+  filter_item_calibration_t *calibration = &captured_calibration;
+  float pressure;
+  if (!tank_volume_compensated_pressure(&pressure) || height_cm < 0 || height_cm > tank_geometry_max_height_cm())
+    return false;
+
+  // a second capture at the same height replaces the first one
+  uint8_t i = 0;
+  while (i < calibration->points_count && calibration->y[i] < height_cm)
+    i++;
+  if (i == calibration->points_count || calibration->y[i] != height_cm)
+  {
+    if (calibration->points_count == SENSOR_CALIBRATION_MAX_POINTS)
+      return false;
+    memmove(&calibration->x[i + 1], &calibration->x[i], (calibration->points_count - i) * sizeof(float));
+    memmove(&calibration->y[i + 1], &calibration->y[i], (calibration->points_count - i) * sizeof(float));
+    calibration->points_count++;
+  }
+  calibration->x[i] = pressure;
+  calibration->y[i] = height_cm;
+  LOG(LL_INFO, ("Calibration point %d, pressure %.1f, height %.1f cm", i, pressure, height_cm));
+  return true;
+}
+
+bool tank_volume_calibration_apply(const char *path)
+{
+  // the pressure has to rise with the height for the table to be usable
+  if (!filter_calibration_calc(&captured_calibration))
+    return false;
+  if (!calibration_save(path, &captured_calibration))
+    return false;
+  sensor_pressure_lock();
+  memcpy(pressure_water_height_calibration.x, captured_calibration.x, sizeof(captured_calibration.x));
+  memcpy(pressure_water_height_calibration.y, captured_calibration.y, sizeof(captured_calibration.y));
+  pressure_water_height_calibration.points_count = captured_calibration.points_count;
+  filter_calibration_calc(&pressure_water_height_calibration);
+  tank_water_height.chain = &tank_water_height_calibrated_chain;
+  sensor_pressure_unlock();
+  captured_calibration.points_count = 0;
+  return true;
+}
+
+void tank_volume_calibration_reset(const char *path)
+{
+  captured_calibration.points_count = 0;
+  sensor_pressure_lock();
+  pressure_water_height_calibration.points_count = 0;
+  tank_water_height.chain = &tank_water_height_chain;
+  sensor_pressure_unlock();
+  remove(path);
+}
+
+static int calibration_points_to_json(struct json_out *out, const filter_item_calibration_t *calibration)
+{
+  int len = json_printf(out, "[");
+  for (uint8_t i = 0; i < calibration->points_count; i++)
+    len += json_printf(out, "%s{pressure:%.2f, height_cm:%.2f}", i > 0 ? ", " : "", calibration->x[i], calibration->y[i]);
+  len += json_printf(out, "]");
+  return len;
+}
+
+int tank_volume_calibration_to_json(struct json_out *out)
+{
+  float pressure;
+  tank_volume_compensated_pressure(&pressure);
+  int len = json_printf(out, "{active:%B, monotone:%B, pressure:%.2f, points:", tank_volume_calibration_active(),
+                        pressure_water_height_calibration.monotone, pressure);
+  len += calibration_points_to_json(out, &pressure_water_height_calibration);
+  len += json_printf(out, ", captured:");
+  len += calibration_points_to_json(out, &captured_calibration);
+  len += json_printf(out, "}");
+  return len;
 }
 
 void tank_volume_init(float pressure_low_threshold, float pressure_high_threshold)
 {
-  // init variables and filters
-  tank_volume_set_threshold(pressure_low_threshold, pressure_high_threshold);
+  tank_geometry_init_from_config();
 
+  // init variables and filters
   percentage_water_height_fit.value_map[0][0] = 0;
   percentage_water_height_fit.value_map[0][1] = 0;
   percentage_water_height_fit.value_map[1][0] = 100;
-  percentage_water_height_fit.value_map[1][1] = 2.0 * tank_radius_cm;
+  percentage_water_height_fit.value_map[1][1] = tank_geometry_max_height_cm();
 
   filter_linear_fit_calc(&percentage_water_height_fit);
 
-  add_filter(&tank_water_height, (filter_item_t *)&pressure_percentage_fit);
-  add_filter(&tank_water_height, (filter_item_t *)&clamp_percentage);
-  add_filter(&tank_water_height, (filter_item_t *)&percentage_water_height_fit);
+  // fuses the filters in the static chain
+  tank_volume_set_threshold(pressure_low_threshold, pressure_high_threshold);
+
+  pressure_water_height_calibration.monotone = mgos_sys_config_get_tank_calibration_monotone();
+  captured_calibration.monotone = pressure_water_height_calibration.monotone;
+  tank_volume_calibration_load(mgos_sys_config_get_tank_calibration_file());
+
+  // the model starts from the constant coefficient, in the pipeline units
+#if PRESSURE_MILLIVOLTS==1
+  float units_per_count = adc_cal_mv_per_count(pressure_low_threshold);
+#else
+  float units_per_count = 1;
+#endif
+  tank_drift_init(temp_compensation_coeff * units_per_count, drift_static_tolerance * units_per_count);
 
+  window_regression_init(&tank_rate_regression, TANK_RATE_WINDOW);
   add_observer(&tank_water_height, on_tank_water_height_change);
 
   mgos_event_add_group_handler(ENV_EVENT_BASE, bme280_cb, NULL);
@@ -1,5 +1,9 @@
 #pragma once
 
+#include "stdbool.h"
+
+struct json_out;
+
 #define VOLUME_EVENT_BASE MGOS_EVENT_BASE('T', 'V', 'L')
 enum volume_event {
   VOLUME_BASE = VOLUME_EVENT_BASE,
@@ -10,8 +14,29 @@ enum volume_event {
 typedef struct tank_volume {
   float tank_percentage;
   float tank_liters;
+  // liters per minute, negative while water is used
+  float tank_rate_lpm;
+  // at the current rate, -1 when not filling or not emptying
+  float tank_seconds_to_full;
+  float tank_seconds_to_empty;
 } tank_volume_t;
 
 
 void tank_volume_init(float pressure_low_threshold, float pressure_high_threshold);
-void tank_volume_set_threshold(float pressure_low_threshold, float pressure_high_threshold);
\ No newline at end of file
+void tank_volume_set_threshold(float pressure_low_threshold, float pressure_high_threshold);
+// last temperature compensated pressure, false before the first measurement
+bool tank_volume_compensated_pressure(float *pressure);
+// volume for a given water height, table lookup in tank_geometry.c
+float tank_volume_liters(float tank_water_height_cm);
+// pressure to water height through a multi-point calibration curve instead
+// of the two pressure thresholds, points are captured during a controlled fill
+// a height_cm measured in the tank is paired with the current compensated pressure
+bool tank_volume_calibration_capture(float height_cm);
+// captured points become the curve and are saved to path
+bool tank_volume_calibration_apply(const char *path);
+// back to the pressure thresholds, drops captured points and the file
+void tank_volume_calibration_reset(const char *path);
+// a <pressure>,<height_cm> line per point, pressure increasing
+bool tank_volume_calibration_load(const char *path);
+bool tank_volume_calibration_active(void);
+int tank_volume_calibration_to_json(struct json_out *out);